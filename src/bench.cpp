@@ -0,0 +1,360 @@
+#include "common.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+const size_t BENCH_SIZES[] = {16, 64, 256, 1024, 4096, 16384, 65529};
+const size_t MAX_BENCH_SIZE = 65529;
+const int DEFAULT_RUNS = 5;
+const double DEFAULT_MIN_RUN_MS = 20;
+const uint8_t BENCH_SEQUENCE = 42;
+
+enum class OutputFormat {
+    CSV,
+    JSON
+};
+
+struct BenchConfig {
+    OutputFormat format = OutputFormat::CSV;
+    int runs = DEFAULT_RUNS;
+    double min_run_ms = DEFAULT_MIN_RUN_MS;
+    std::string filter;
+};
+
+// ns_per_op is the median over the timed runs; min and max show the spread.
+struct BenchResult {
+    std::string name;
+    size_t size;
+    uint64_t iterations;
+    double ns_per_op;
+    double min_ns_per_op;
+    double max_ns_per_op;
+    double bytes_per_second;
+};
+
+bool parse_arguments(int argc, char* argv[], BenchConfig& config);
+bool verify_cipher();
+BenchResult run_benchmark(const BenchConfig& config, const std::string& name, size_t size,
+                          const std::function<void(uint64_t)>& body);
+void run_codec_benchmarks(const BenchConfig& config, std::vector<BenchResult>& results);
+void run_cipher_benchmarks(const BenchConfig& config, std::vector<BenchResult>& results);
+void print_results(const BenchConfig& config, const std::vector<BenchResult>& results);
+
+// Keeps the compiler from discarding work whose result is never read.
+template <typename T>
+inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+int main(int argc, char* argv[]) {
+    BenchConfig config;
+    if (!parse_arguments(argc, argv, config)) {
+        std::cerr << "Usage: " << argv[0] << " [--format=csv|json] [--runs N] [--min-run-ms MS] [--filter NAME]\n";
+        return 1;
+    }
+
+    // A fast cipher that produces the wrong bytes is not worth timing.
+    if (!verify_cipher()) {
+        return 1;
+    }
+
+    std::vector<BenchResult> results;
+    run_codec_benchmarks(config, results);
+    run_cipher_benchmarks(config, results);
+    print_results(config, results);
+    return 0;
+}
+
+bool parse_arguments(int argc, char* argv[], BenchConfig& config) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+        size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) == 0 && eq != std::string::npos) {
+            value = arg.substr(eq + 1);
+            arg = arg.substr(0, eq);
+        } else if (arg.rfind("--", 0) == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << "\n";
+                return false;
+            }
+            value = argv[++i];
+        }
+
+        if (arg == "--format") {
+            if (value == "csv") {
+                config.format = OutputFormat::CSV;
+            } else if (value == "json") {
+                config.format = OutputFormat::JSON;
+            } else {
+                std::cerr << "Unknown format: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--runs") {
+            config.runs = atoi(value.c_str());
+            if (config.runs < 1) {
+                std::cerr << "Invalid run count: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--min-run-ms") {
+            config.min_run_ms = atof(value.c_str());
+            if (config.min_run_ms <= 0) {
+                std::cerr << "Invalid run time: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--filter") {
+            config.filter = value;
+        } else {
+            std::cerr << "Unknown argument: " << arg << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Straight per-byte form of the echo cipher, as the original
+// encrypt_echo_message computed it: the multiply-add wraps in 32 bits
+// before the modulo, and each byte is XORed with the key's low byte.
+static void reference_cipher(uint32_t seed, const uint8_t* input, uint8_t* output, size_t size) {
+    uint32_t key = seed;
+    for (size_t i = 0; i < size; ++i) {
+        key = (key * 1103515245 + 12345) % 0x7FFFFFFF;
+        output[i] = input[i] ^ static_cast<uint8_t>(key % 256);
+    }
+}
+
+// Checks every cipher entry point against the reference over odd sizes
+// that exercise the vector kernels' tails and the keystream cache's
+// prefix boundary.
+bool verify_cipher() {
+    const size_t sizes[] = {0, 1, 15, 31, 33, 255, 256, 257, 511, 512, 513, 4099, MAX_BENCH_SIZE};
+    std::vector<uint8_t> input(MAX_BENCH_SIZE);
+    std::vector<uint8_t> expected(MAX_BENCH_SIZE);
+    std::vector<uint8_t> actual(MAX_BENCH_SIZE);
+    for (size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<uint8_t>(i * 7 + 3);
+    }
+
+    UserCredentials credentials = {"admin", "12345"};
+    EchoKey key = derive_echo_key(credentials);
+    KeystreamCache cache;
+    for (size_t size : sizes) {
+        for (uint8_t sequence : {uint8_t(0), BENCH_SEQUENCE, uint8_t(255)}) {
+            uint32_t seed = echo_cipher_seed(key, sequence);
+            reference_cipher(seed, input.data(), expected.data(), size);
+
+            apply_echo_cipher(seed, input.data(), actual.data(), size);
+            bool ok = std::equal(expected.begin(), expected.begin() + size, actual.begin());
+
+            for (int pass = 0; pass < 2 && ok; ++pass) {
+                cache.apply(seed, input.data(), actual.data(), size);
+                ok = std::equal(expected.begin(), expected.begin() + size, actual.begin());
+            }
+
+            std::string plain(reinterpret_cast<const char*>(input.data()), size);
+            std::string cipher = encrypt_echo_message(credentials, sequence, plain);
+            ok = ok && std::equal(expected.begin(), expected.begin() + size, reinterpret_cast<const uint8_t*>(cipher.data()));
+
+            if (!ok) {
+                std::cerr << "Cipher mismatch against the reference at size " << size << ", sequence "
+                          << static_cast<int>(sequence) << " (" << xor_kernel_name() << " kernel)\n";
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// The iteration count is doubled until one run takes at least
+// min_run_ms; that calibration doubles as warmup. The timed runs then
+// reuse the calibrated count.
+BenchResult run_benchmark(const BenchConfig& config, const std::string& name, size_t size,
+                          const std::function<void(uint64_t)>& body) {
+    using Clock = std::chrono::steady_clock;
+    auto time_run = [&](uint64_t iterations) {
+        Clock::time_point start = Clock::now();
+        body(iterations);
+        return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    };
+
+    uint64_t iterations = 1;
+    while (time_run(iterations) < config.min_run_ms * 1e6 && iterations < (uint64_t(1) << 40)) {
+        iterations *= 2;
+    }
+
+    std::vector<double> samples;
+    for (int run = 0; run < config.runs; ++run) {
+        samples.push_back(time_run(iterations) / iterations);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    BenchResult result;
+    result.name = name;
+    result.size = size;
+    result.iterations = iterations;
+    result.ns_per_op = samples[samples.size() / 2];
+    result.min_ns_per_op = samples.front();
+    result.max_ns_per_op = samples.back();
+    result.bytes_per_second = size * 1e9 / result.ns_per_op;
+    return result;
+}
+
+static bool selected(const BenchConfig& config, const std::string& name) {
+    return config.filter.empty() || name.find(config.filter) != std::string::npos;
+}
+
+// Each pair serializes a message and decodes it again, the way one side
+// of the connection produces a frame and the other consumes it.
+void run_codec_benchmarks(const BenchConfig& config, std::vector<BenchResult>& results) {
+    std::vector<uint8_t> buffer(HEADER_BYTE_SIZE + SIZE_BYTE_SIZE + MAX_BENCH_SIZE);
+
+    if (selected(config, "header")) {
+        Header header = {LOGIN_REQUEST_BYTE_SIZE, LOGIN_REQUEST_TYPE, BENCH_SEQUENCE};
+        results.push_back(run_benchmark(config, "header", HEADER_BYTE_SIZE, [&](uint64_t iterations) {
+            Header decoded;
+            for (uint64_t i = 0; i < iterations; ++i) {
+                serialize_header(header, buffer.data());
+                do_not_optimize(buffer[0]);
+                deserialize_header(decoded, buffer.data());
+                do_not_optimize(decoded);
+            }
+        }));
+    }
+
+    if (selected(config, "login_request")) {
+        LoginRequest request = {{LOGIN_REQUEST_BYTE_SIZE, LOGIN_REQUEST_TYPE, BENCH_SEQUENCE}, {"admin", "12345"}};
+        results.push_back(run_benchmark(config, "login_request", LOGIN_REQUEST_BYTE_SIZE, [&](uint64_t iterations) {
+            LoginRequest decoded;
+            for (uint64_t i = 0; i < iterations; ++i) {
+                serialize_login_request(request, buffer.data());
+                do_not_optimize(buffer[0]);
+                deserialize_login_request(decoded, buffer.data());
+                do_not_optimize(decoded);
+            }
+        }));
+    }
+
+    for (size_t size : BENCH_SIZES) {
+        uint16_t frame_size = static_cast<uint16_t>(HEADER_BYTE_SIZE + SIZE_BYTE_SIZE + size);
+        std::string payload(size, 'x');
+
+        if (selected(config, "echo_request")) {
+            EchoRequest request = {{frame_size, ECHO_REQUEST_TYPE, BENCH_SEQUENCE}, static_cast<uint16_t>(size), payload};
+            results.push_back(run_benchmark(config, "echo_request", size, [&](uint64_t iterations) {
+                EchoRequest decoded;
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    serialize_echo_request(request, buffer.data());
+                    do_not_optimize(buffer[0]);
+                    deserialize_echo_request(decoded, buffer.data());
+                    do_not_optimize(decoded.cipher_message[0]);
+                }
+            }));
+        }
+
+        if (selected(config, "echo_request_view")) {
+            EchoRequestView request = {{frame_size, ECHO_REQUEST_TYPE, BENCH_SEQUENCE}, static_cast<uint16_t>(size), payload};
+            results.push_back(run_benchmark(config, "echo_request_view", size, [&](uint64_t iterations) {
+                EchoRequestView decoded;
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    serialize_echo_request(request, buffer.data());
+                    do_not_optimize(buffer[0]);
+                    deserialize_echo_request(decoded, buffer.data());
+                    do_not_optimize(decoded);
+                }
+            }));
+        }
+
+        if (selected(config, "echo_response")) {
+            EchoResponse response = {{frame_size, ECHO_RESPONSE_TYPE, BENCH_SEQUENCE}, static_cast<uint16_t>(size), payload};
+            results.push_back(run_benchmark(config, "echo_response", size, [&](uint64_t iterations) {
+                EchoResponse decoded;
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    serialize_echo_response(response, buffer.data());
+                    do_not_optimize(buffer[0]);
+                    deserialize_echo_response(decoded, buffer.data());
+                    do_not_optimize(decoded.plain_message[0]);
+                }
+            }));
+        }
+
+        if (selected(config, "echo_response_view")) {
+            EchoResponseView response = {{frame_size, ECHO_RESPONSE_TYPE, BENCH_SEQUENCE}, static_cast<uint16_t>(size), payload};
+            results.push_back(run_benchmark(config, "echo_response_view", size, [&](uint64_t iterations) {
+                EchoResponseView decoded;
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    serialize_echo_response(response, buffer.data());
+                    do_not_optimize(buffer[0]);
+                    deserialize_echo_response(decoded, buffer.data());
+                    do_not_optimize(decoded);
+                }
+            }));
+        }
+    }
+}
+
+void run_cipher_benchmarks(const BenchConfig& config, std::vector<BenchResult>& results) {
+    UserCredentials credentials = {"admin", "12345"};
+    EchoKey key = derive_echo_key(credentials);
+    uint32_t seed = echo_cipher_seed(key, BENCH_SEQUENCE);
+    std::vector<uint8_t> input(MAX_BENCH_SIZE, 'x');
+    std::vector<uint8_t> output(MAX_BENCH_SIZE);
+
+    for (size_t size : BENCH_SIZES) {
+        std::string message(size, 'x');
+
+        if (selected(config, "encrypt_echo_message")) {
+            results.push_back(run_benchmark(config, "encrypt_echo_message", size, [&](uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    std::string cipher = encrypt_echo_message(key, BENCH_SEQUENCE, message);
+                    do_not_optimize(cipher[0]);
+                }
+            }));
+        }
+
+        if (selected(config, "apply_echo_cipher")) {
+            results.push_back(run_benchmark(config, "apply_echo_cipher", size, [&](uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    apply_echo_cipher(seed, input.data(), output.data(), size);
+                    do_not_optimize(output[0]);
+                }
+            }));
+        }
+
+        // Same seed every time, so after the first call this measures the
+        // cache-hit path the server takes for a repeated sequence number.
+        if (selected(config, "keystream_cache")) {
+            KeystreamCache cache;
+            results.push_back(run_benchmark(config, "keystream_cache", size, [&](uint64_t iterations) {
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    cache.apply(seed, input.data(), output.data(), size);
+                    do_not_optimize(output[0]);
+                }
+            }));
+        }
+    }
+}
+
+void print_results(const BenchConfig& config, const std::vector<BenchResult>& results) {
+    if (config.format == OutputFormat::CSV) {
+        printf("name,size,iterations,ns_per_op,min_ns_per_op,max_ns_per_op,bytes_per_second\n");
+        for (const BenchResult& result : results) {
+            printf("%s,%zu,%llu,%.2f,%.2f,%.2f,%.0f\n", result.name.c_str(), result.size,
+                   static_cast<unsigned long long>(result.iterations), result.ns_per_op,
+                   result.min_ns_per_op, result.max_ns_per_op, result.bytes_per_second);
+        }
+        return;
+    }
+
+    printf("{\n  \"xor_kernel\": \"%s\",\n  \"runs\": %d,\n  \"results\": [\n", xor_kernel_name(), config.runs);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& result = results[i];
+        printf("    {\"name\": \"%s\", \"size\": %zu, \"iterations\": %llu, \"ns_per_op\": %.2f, "
+               "\"min_ns_per_op\": %.2f, \"max_ns_per_op\": %.2f, \"bytes_per_second\": %.0f}%s\n",
+               result.name.c_str(), result.size, static_cast<unsigned long long>(result.iterations),
+               result.ns_per_op, result.min_ns_per_op, result.max_ns_per_op, result.bytes_per_second,
+               i + 1 < results.size() ? "," : "");
+    }
+    printf("  ]\n}\n");
+}
@@ -0,0 +1,187 @@
+#include "capture.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Set once by start_capture, before the reactors start.
+static CaptureRecord* capture_records = nullptr;
+static uint64_t capture_chunks = 0;
+static uint64_t capture_started = 0;
+static std::atomic<bool>* chunk_busy = nullptr;
+static std::atomic<uint64_t> next_chunk(0);
+static std::atomic<uint32_t> next_connection(0);
+
+const uint64_t NO_CHUNK = ~uint64_t(0);
+
+// The chunk the calling reactor is filling, and the rest of it.
+thread_local uint64_t chunk_held = NO_CHUNK;
+thread_local CaptureRecord* chunk_next = nullptr;
+thread_local CaptureRecord* chunk_end = nullptr;
+
+static uint64_t clock_ns(clockid_t clock) {
+    timespec now;
+    clock_gettime(clock, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+bool start_capture(const char* path, uint64_t record_capacity, std::string& error) {
+    capture_chunks = std::max<uint64_t>(1, (record_capacity + CAPTURE_CHUNK_RECORDS - 1) / CAPTURE_CHUNK_RECORDS);
+    size_t size = sizeof(CaptureFileHeader) + capture_chunks * CAPTURE_CHUNK_RECORDS * sizeof(CaptureRecord);
+
+    int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        error = strerror(errno);
+        return false;
+    }
+    // The file starts out sparse, and unused records read as zero, which
+    // is CaptureEvent::NONE.
+    if (ftruncate(fd, static_cast<off_t>(size)) == -1) {
+        error = strerror(errno);
+        close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        error = strerror(errno);
+        return false;
+    }
+
+    CaptureFileHeader* header = static_cast<CaptureFileHeader*>(mapped);
+    memcpy(header->magic, CAPTURE_FILE_MAGIC, sizeof header->magic);
+    header->version = CAPTURE_FILE_VERSION;
+    header->record_size = sizeof(CaptureRecord);
+    header->record_capacity = capture_chunks * CAPTURE_CHUNK_RECORDS;
+    header->started_ns = clock_ns(CLOCK_REALTIME);
+    capture_started = clock_ns(CLOCK_MONOTONIC);
+    chunk_busy = new std::atomic<bool>[capture_chunks]();
+    capture_records = reinterpret_cast<CaptureRecord*>(header + 1);
+    return true;
+}
+
+bool capture_enabled() {
+    return capture_records != nullptr;
+}
+
+// Hands back the chunk the reactor filled and takes the next one in the
+// ring that no other reactor holds. Once the ring has wrapped, a reactor
+// that is slow to fill its chunk would otherwise have another one claim
+// the same chunk and write over it while it is still writing, interleaving
+// their records. A claimed chunk may still hold records from the last lap
+// of the ring, so it is cleared first. Returns false, and the record is
+// dropped, if every chunk is held.
+static bool claim_chunk() {
+    if (chunk_held != NO_CHUNK) {
+        chunk_busy[chunk_held].store(false, std::memory_order_release);
+        chunk_held = NO_CHUNK;
+    }
+    for (uint64_t attempt = 0; attempt < capture_chunks; ++attempt) {
+        uint64_t chunk = next_chunk.fetch_add(1, std::memory_order_relaxed) % capture_chunks;
+        bool busy = false;
+        if (chunk_busy[chunk].compare_exchange_strong(busy, true, std::memory_order_acquire)) {
+            chunk_held = chunk;
+            chunk_next = capture_records + chunk * CAPTURE_CHUNK_RECORDS;
+            chunk_end = chunk_next + CAPTURE_CHUNK_RECORDS;
+            memset(static_cast<void*>(chunk_next), 0, CAPTURE_CHUNK_RECORDS * sizeof(CaptureRecord));
+            return true;
+        }
+    }
+    chunk_next = nullptr;
+    chunk_end = nullptr;
+    return false;
+}
+
+// Fills in the next record of the reactor's chunk, claiming a fresh chunk
+// when it runs out. The event is stored last, so a replay reading the file
+// while it is written skips a half-written record.
+static void capture_record(CaptureEvent event, uint32_t connection, const Header& header, uint32_t size, uint16_t count) {
+    if (chunk_next == chunk_end && !claim_chunk()) {
+        return;
+    }
+    CaptureRecord* record = chunk_next++;
+    record->time_ns = clock_ns(CLOCK_MONOTONIC) - capture_started;
+    record->connection = connection;
+    record->size = size;
+    record->count = count;
+    record->message_type = header.message_type;
+    record->message_sequence = header.message_sequence;
+    __atomic_store_n(reinterpret_cast<uint8_t*>(&record->event), static_cast<uint8_t>(event), __ATOMIC_RELEASE);
+}
+
+uint32_t capture_open() {
+    uint32_t connection = next_connection.fetch_add(1, std::memory_order_relaxed) + 1;
+    capture_record(CaptureEvent::OPEN, connection, Header{0, 0, 0}, 0, 0);
+    return connection;
+}
+
+void capture_frame(uint32_t connection, const Header& header, uint32_t size, uint16_t count) {
+    capture_record(CaptureEvent::FRAME, connection, header, size, count);
+}
+
+void capture_close(uint32_t connection) {
+    capture_record(CaptureEvent::CLOSE, connection, Header{0, 0, 0}, 0, 0);
+}
+
+CaptureFile::~CaptureFile() {
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_size);
+    }
+}
+
+bool CaptureFile::open(const char* path, std::string& error) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        error = strerror(errno);
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) == -1) {
+        error = strerror(errno);
+        close(fd);
+        return false;
+    }
+    size_t size = static_cast<size_t>(status.st_size);
+    if (size < sizeof(CaptureFileHeader)) {
+        error = "not a capture file";
+        close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        error = strerror(errno);
+        return false;
+    }
+
+    const CaptureFileHeader* mapped_header = static_cast<const CaptureFileHeader*>(mapped);
+    if (memcmp(mapped_header->magic, CAPTURE_FILE_MAGIC, sizeof mapped_header->magic) != 0) {
+        error = "not a capture file";
+    } else if (mapped_header->version != CAPTURE_FILE_VERSION || mapped_header->record_size != sizeof(CaptureRecord)) {
+        error = "unsupported capture file version " + std::to_string(mapped_header->version);
+    } else if (mapped_header->record_capacity > (size - sizeof(CaptureFileHeader)) / sizeof(CaptureRecord)) {
+        error = "capture file is truncated";
+    } else {
+        error.clear();
+    }
+    if (!error.empty()) {
+        munmap(mapped, size);
+        return false;
+    }
+
+    // Replay walks the records once, front to back.
+    madvise(mapped, size, MADV_SEQUENTIAL);
+
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_size);
+    }
+    mapping = mapped;
+    mapping_size = size;
+    header = mapped_header;
+    records = reinterpret_cast<const CaptureRecord*>(header + 1);
+    record_capacity = header->record_capacity;
+    return true;
+}
@@ -0,0 +1,108 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include "common.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Traffic capture file, written by the server's --capture option and read
+// by replay. It is laid out in host byte order as
+//
+//   CaptureFileHeader
+//   CaptureRecord records[record_capacity]
+//
+// The records form a ring that each reactor fills a chunk of
+// CAPTURE_CHUNK_RECORDS at a time, so reactors share one atomic increment
+// per chunk rather than per frame. A full ring wraps and overwrites its
+// oldest chunk, passing over chunks another reactor is still filling; if
+// every chunk is held, records are dropped until one is handed back, so
+// give the ring a few chunks per reactor. Records are ordered by time
+// within a chunk, and chunks by when they were claimed; a record whose
+// event is NONE is unused.
+//
+// A record is only complete once its event is set, which is stored last.
+// Still, a file read while the server is writing it can catch a chunk
+// that is being cleared for reuse, with records partly zeroed, so readers
+// should check the fields before trusting them.
+//
+// Only what shapes the load is kept, never payloads or credentials: when
+// each connection opened and closed, and the header, size and message
+// count of every frame it sent.
+const char CAPTURE_FILE_MAGIC[8] = {'E', 'C', 'H', 'O', 'C', 'A', 'P', 'T'};
+const uint32_t CAPTURE_FILE_VERSION = 1;
+const size_t CAPTURE_CHUNK_RECORDS = 256;
+const uint64_t DEFAULT_CAPTURE_RECORDS = 1 << 20;
+
+enum class CaptureEvent : uint8_t {
+    NONE,
+    OPEN,
+    FRAME,
+    CLOSE
+};
+
+// started_ns is the wall-clock time of the first record's time_ns of 0.
+struct CaptureFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t record_capacity;
+    uint64_t started_ns;
+};
+
+// time_ns counts from the start of the capture. connection numbers the
+// server's connections from 1 in the order they were accepted. size is the
+// whole frame in bytes, except for echo streams, where it is the payload
+// size from the stream header; count is the number of messages in a batch
+// and 1 for any other frame.
+struct CaptureRecord {
+    uint64_t time_ns;
+    uint32_t connection;
+    uint32_t size;
+    uint16_t count;
+    CaptureEvent event;
+    uint8_t message_type;
+    uint8_t message_sequence;
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(CaptureFileHeader) == 32, "capture file header layout");
+static_assert(sizeof(CaptureRecord) == 24, "capture record layout");
+
+// Creates the capture file at path with room for at least record_capacity
+// records and starts capturing into it. Returns false, describing why in
+// error, if the file could not be created and mapped.
+bool start_capture(const char* path, uint64_t record_capacity, std::string& error);
+
+bool capture_enabled();
+
+// Numbers a new connection and records its OPEN.
+uint32_t capture_open();
+void capture_frame(uint32_t connection, const Header& header, uint32_t size, uint16_t count);
+void capture_close(uint32_t connection);
+
+// A capture file mapped read-only, for replay.
+class CaptureFile {
+public:
+    CaptureFile() = default;
+    ~CaptureFile();
+    CaptureFile(const CaptureFile&) = delete;
+    CaptureFile& operator=(const CaptureFile&) = delete;
+
+    // Returns false, describing why in error, if path is not a valid
+    // capture file.
+    bool open(const char* path, std::string& error);
+
+    uint64_t capacity() const { return record_capacity; }
+    const CaptureRecord& record(uint64_t index) const { return records[index]; }
+    uint64_t started_ns() const { return header->started_ns; }
+
+private:
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+    const CaptureFileHeader* header = nullptr;
+    const CaptureRecord* records = nullptr;
+    uint64_t record_capacity = 0;
+};
+
+#endif
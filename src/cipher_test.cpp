@@ -0,0 +1,119 @@
+#include "common.hpp"
+#include <algorithm>
+
+// Checks the echo cipher against the per-byte form the original
+// encrypt_echo_message used, through every XOR kernel this CPU can run and
+// through KeystreamCache. Exits non-zero on the first mismatch.
+
+const size_t MAX_TAIL_SIZE = 70;
+const size_t LARGE_SIZES[] = {1024, 4096, 4099, 16411, 65529};
+const size_t MAX_TEST_SIZE = 65529;
+
+// Straight per-byte form of the echo cipher: the multiply-add wraps in 32
+// bits before the modulo, and each byte is XORed with the key's low byte.
+static void reference_cipher(uint32_t seed, const uint8_t* input, uint8_t* output, size_t size) {
+    uint32_t key = seed;
+    for (size_t i = 0; i < size; ++i) {
+        key = (key * 1103515245 + 12345) % 0x7FFFFFFF;
+        output[i] = input[i] ^ static_cast<uint8_t>(key % 256);
+    }
+}
+
+struct CipherCheck {
+    std::vector<std::string> kernels;
+    std::vector<uint8_t> input;
+    std::vector<uint8_t> expected;
+    std::vector<uint8_t> actual;
+    KeystreamCache cache;
+    uint64_t checked = 0;
+};
+
+static bool report_mismatch(const CipherCheck& check, const char* path, uint32_t seed, size_t size) {
+    size_t offset = std::mismatch(check.expected.begin(), check.expected.begin() + size, check.actual.begin()).first -
+                    check.expected.begin();
+    std::cerr << "Mismatch in " << path << " at byte " << offset << " of " << size << " (username sum "
+              << ((seed >> 8) & 0xFF) << ", password sum " << (seed & 0xFF) << ", sequence " << (seed >> 16) << ")\n";
+    return false;
+}
+
+static bool matches(const CipherCheck& check, size_t size) {
+    return std::equal(check.expected.begin(), check.expected.begin() + size, check.actual.begin());
+}
+
+// Runs one seed and size through every kernel and through the cache. The
+// cache keeps the seed from one kernel to the next, so the first kernel
+// checks both its miss and its hit path and the others its hit path.
+static bool check_seed(CipherCheck& check, uint32_t seed, size_t size) {
+    reference_cipher(seed, check.input.data(), check.expected.data(), size);
+    for (size_t i = 0; i < check.kernels.size(); ++i) {
+        const std::string& kernel = check.kernels[i];
+        use_xor_kernel(kernel);
+        apply_echo_cipher(seed, check.input.data(), check.actual.data(), size);
+        if (!matches(check, size)) {
+            return report_mismatch(check, kernel.c_str(), seed, size);
+        }
+        for (int pass = i == 0 ? 0 : 1; pass < 2; ++pass) {
+            check.cache.apply(seed, check.input.data(), check.actual.data(), size);
+            if (!matches(check, size)) {
+                return report_mismatch(check, (kernel + " KeystreamCache").c_str(), seed, size);
+            }
+        }
+        ++check.checked;
+    }
+    return true;
+}
+
+int main() {
+    CipherCheck check;
+    check.kernels = available_xor_kernels();
+    check.input.resize(MAX_TEST_SIZE);
+    check.expected.resize(MAX_TEST_SIZE);
+    check.actual.resize(MAX_TEST_SIZE);
+    for (size_t i = 0; i < check.input.size(); ++i) {
+        check.input[i] = static_cast<uint8_t>(i * 7 + 3);
+    }
+
+    std::cout << "Kernels:";
+    for (const std::string& kernel : check.kernels) {
+        std::cout << " " << kernel;
+    }
+    std::cout << "\n";
+
+    // Every seed, each at one size from 0 to MAX_TAIL_SIZE in turn, so every
+    // tail shorter than a 16- and 32-byte vector meets a quarter of a million
+    // seeds without running all 71 sizes for all 2^24 of them.
+    size_t size = 0;
+    for (int username_sum = 0; username_sum < 256; ++username_sum) {
+        for (int password_sum = 0; password_sum < 256; ++password_sum) {
+            EchoKey key = {static_cast<uint8_t>(username_sum), static_cast<uint8_t>(password_sum)};
+            for (int sequence = 0; sequence < 256; ++sequence) {
+                if (!check_seed(check, echo_cipher_seed(key, static_cast<uint8_t>(sequence)), size)) {
+                    return 1;
+                }
+                size = size == MAX_TAIL_SIZE ? 0 : size + 1;
+            }
+        }
+    }
+
+    // Every size from 0 to MAX_TAIL_SIZE, and messages longer than the
+    // keystream block and the cache's prefix, for every sequence of a few keys.
+    const EchoKey keys[] = {{0, 0}, {0xFF, 0xFF}, derive_echo_key(UserCredentials{"admin", "12345"})};
+    for (const EchoKey& key : keys) {
+        for (int sequence = 0; sequence < 256; ++sequence) {
+            uint32_t seed = echo_cipher_seed(key, static_cast<uint8_t>(sequence));
+            for (size_t tail = 0; tail <= MAX_TAIL_SIZE; ++tail) {
+                if (!check_seed(check, seed, tail)) {
+                    return 1;
+                }
+            }
+            for (size_t large : LARGE_SIZES) {
+                if (!check_seed(check, seed, large)) {
+                    return 1;
+                }
+            }
+        }
+    }
+
+    std::cout << "All " << check.checked << " cipher checks match the reference\n";
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "common.hpp"
+#include <poll.h>
 
 const char DEFAULT_SERVER_IP[] = "127.0.0.1";
 const uint16_t MESSAGE_SEQUENCE = 10;
@@ -35,7 +36,7 @@ int connect_to_server(const char* server_ip, const char* port) {
 
 void handle_login_response(int sockfd) {
     std::vector<uint8_t> buffer(LOGIN_RESPONSE_BYTE_SIZE);
-    int count = recv(sockfd, buffer.data(), LOGIN_RESPONSE_BYTE_SIZE, 0);
+    int count = recv(sockfd, buffer.data(), LOGIN_RESPONSE_BYTE_SIZE, MSG_WAITALL);
     
     if (count != LOGIN_RESPONSE_BYTE_SIZE) {
         std::cerr << "Error receiving login response: " << strerror(errno) << "\n";
@@ -45,12 +46,19 @@ void handle_login_response(int sockfd) {
     LoginResponse response;
     deserialize_login_response(response, buffer.data());
 
+    // A server with resumption enabled appends a ticket, which this client
+    // has no use for.
+    if (response.header.message_size > LOGIN_RESPONSE_BYTE_SIZE) {
+        std::vector<uint8_t> ticket(response.header.message_size - LOGIN_RESPONSE_BYTE_SIZE);
+        recv(sockfd, ticket.data(), ticket.size(), MSG_WAITALL);
+    }
+
     std::cout << "Login Response Status: " << response.status_code << std::endl;
 }
 
 void handle_echo_response(int sockfd) {
     std::vector<uint8_t> buffer(HEADER_BYTE_SIZE);
-    if (recv(sockfd, buffer.data(), HEADER_BYTE_SIZE, 0) != HEADER_BYTE_SIZE) {
+    if (recv(sockfd, buffer.data(), HEADER_BYTE_SIZE, MSG_WAITALL) != HEADER_BYTE_SIZE) {
         std::cerr << "Error receiving echo response header: " << strerror(errno) << "\n";
         return;
     }
@@ -59,7 +67,9 @@ void handle_echo_response(int sockfd) {
     deserialize_header(header, buffer.data());
 
     buffer.resize(header.message_size);
-    if (recv(sockfd, &buffer[HEADER_BYTE_SIZE], header.message_size, 0) != header.message_size - HEADER_BYTE_SIZE) {
+    ssize_t body_size = header.message_size - HEADER_BYTE_SIZE;
+    if (header.message_size < HEADER_BYTE_SIZE + SIZE_BYTE_SIZE ||
+        recv(sockfd, &buffer[HEADER_BYTE_SIZE], body_size, MSG_WAITALL) != body_size) {
         std::cerr << "Error receiving echo response message: " << strerror(errno) << "\n";
         return;
     }
@@ -73,7 +83,7 @@ void handle_echo_response(int sockfd) {
 void login(int sockfd, const UserCredentials &credentials) {
     LoginRequest request = {{LOGIN_REQUEST_BYTE_SIZE, LOGIN_REQUEST_TYPE, MESSAGE_SEQUENCE}, credentials};
 
-    std::vector<uint8_t> buffer(1024);
+    std::vector<uint8_t> buffer(LOGIN_REQUEST_BYTE_SIZE);
     serialize_login_request(request, buffer.data());
 
     if (send(sockfd, buffer.data(), request.header.message_size, 0) == -1) {
@@ -88,7 +98,7 @@ void send_echo_request(int sockfd, const UserCredentials &credentials, const std
     uint16_t totalSize = static_cast<uint16_t>(HEADER_BYTE_SIZE + SIZE_BYTE_SIZE + cipher_message.size());
     EchoRequest request = {{totalSize, ECHO_REQUEST_TYPE, MESSAGE_SEQUENCE}, static_cast<uint16_t>(cipher_message.size()), cipher_message};
 
-    std::vector<uint8_t> buffer(1024);
+    std::vector<uint8_t> buffer(request.header.message_size);
     serialize_echo_request(request, buffer.data());
 
     if (send(sockfd, buffer.data(), request.header.message_size, 0) == -1) {
@@ -98,6 +108,140 @@ void send_echo_request(int sockfd, const UserCredentials &credentials, const std
     handle_echo_response(sockfd);
 }
 
+void handle_echo_batch_response(int sockfd) {
+    std::vector<uint8_t> buffer(HEADER_BYTE_SIZE);
+    if (recv(sockfd, buffer.data(), HEADER_BYTE_SIZE, MSG_WAITALL) != HEADER_BYTE_SIZE) {
+        std::cerr << "Error receiving echo batch response header: " << strerror(errno) << "\n";
+        return;
+    }
+
+    Header header;
+    deserialize_header(header, buffer.data());
+
+    buffer.resize(header.message_size);
+    ssize_t body_size = header.message_size - HEADER_BYTE_SIZE;
+    if (header.message_type != ECHO_BATCH_RESPONSE_TYPE || header.message_size < ECHO_BATCH_HEADER_BYTE_SIZE ||
+        recv(sockfd, &buffer[HEADER_BYTE_SIZE], body_size, MSG_WAITALL) != body_size) {
+        std::cerr << "Error receiving echo batch response: " << strerror(errno) << "\n";
+        return;
+    }
+
+    EchoBatchResponse response;
+    deserialize_echo_batch_response(response, buffer.data());
+
+    for (const EchoBatchEntry& message : response.messages) {
+        std::cout << "Echo Batch Response Message " << static_cast<int>(message.message_sequence) << ": "
+                  << message.message << std::endl;
+    }
+}
+
+// Every message in the batch gets its own sequence, counting up from
+// MESSAGE_SEQUENCE, and is encrypted with it.
+void send_echo_batch_request(int sockfd, const UserCredentials &credentials, const std::vector<std::string> &messages) {
+    EchoBatchRequest request;
+    for (size_t i = 0; i < messages.size(); ++i) {
+        uint8_t sequence = static_cast<uint8_t>(MESSAGE_SEQUENCE + i);
+        request.messages.push_back({sequence, encrypt_echo_message(credentials, sequence, messages[i])});
+    }
+    request.header = {echo_batch_frame_size(request.messages), ECHO_BATCH_REQUEST_TYPE, MESSAGE_SEQUENCE};
+
+    std::vector<uint8_t> buffer(request.header.message_size);
+    serialize_echo_batch_request(request, buffer.data());
+
+    if (send(sockfd, buffer.data(), request.header.message_size, 0) == -1) {
+        std::cerr << "Error sending echo batch request: " << strerror(errno) << "\n";
+    }
+
+    handle_echo_batch_response(sockfd);
+}
+
+// Streams size bytes of text through the server and checks what comes
+// back. Sending and receiving are interleaved: the server stops reading
+// while its responses to us are backed up, so sending the whole payload
+// before reading could deadlock.
+bool send_echo_stream_request(int sockfd, const UserCredentials &credentials, uint32_t size) {
+    std::string message(size, '\0');
+    for (uint32_t i = 0; i < size; ++i) {
+        message[i] = static_cast<char>('a' + i % 26);
+    }
+
+    EchoStreamHeader header = {{ECHO_STREAM_HEADER_BYTE_SIZE, ECHO_STREAM_REQUEST_TYPE, MESSAGE_SEQUENCE}, size};
+    std::vector<uint8_t> request(ECHO_STREAM_HEADER_BYTE_SIZE);
+    serialize_echo_stream_header(header, request.data());
+    std::string cipher_message = encrypt_echo_message(credentials, MESSAGE_SEQUENCE, message);
+    request.insert(request.end(), cipher_message.begin(), cipher_message.end());
+
+    std::vector<uint8_t> response(ECHO_STREAM_HEADER_BYTE_SIZE + size_t(size));
+    size_t sent = 0;
+    size_t received = 0;
+    while (received < response.size()) {
+        struct pollfd pfd = {sockfd, static_cast<short>(POLLIN | (sent < request.size() ? POLLOUT : 0)), 0};
+        if (poll(&pfd, 1, -1) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Error waiting for the server: " << strerror(errno) << "\n";
+            return false;
+        }
+        if (pfd.revents & POLLOUT) {
+            ssize_t count = send(sockfd, request.data() + sent, request.size() - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (count == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                std::cerr << "Error sending echo stream: " << strerror(errno) << "\n";
+                return false;
+            }
+            sent += count > 0 ? count : 0;
+        }
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            ssize_t count = recv(sockfd, response.data() + received, response.size() - received, MSG_DONTWAIT);
+            if (count == 0 || (count == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                std::cerr << "Error receiving echo stream: " << (count == 0 ? "connection closed" : strerror(errno)) << "\n";
+                return false;
+            }
+            received += count > 0 ? count : 0;
+        }
+    }
+
+    deserialize_echo_stream_header(header, response.data());
+    if (header.header.message_type != ECHO_STREAM_RESPONSE_TYPE || header.message_size != size ||
+        memcmp(response.data() + ECHO_STREAM_HEADER_BYTE_SIZE, message.data(), size) != 0) {
+        std::cerr << "Echo stream response does not match the request\n";
+        return false;
+    }
+
+    std::cout << "Echo Stream Response: " << size << " bytes verified" << std::endl;
+    return true;
+}
+
+// Stats requests need no login, so this is all a scraper has to send.
+void request_stats(int sockfd) {
+    std::vector<uint8_t> buffer(STATS_REQUEST_BYTE_SIZE);
+    Header header = {STATS_REQUEST_BYTE_SIZE, STATS_REQUEST_TYPE, MESSAGE_SEQUENCE};
+    serialize_header(header, buffer.data());
+
+    if (send(sockfd, buffer.data(), STATS_REQUEST_BYTE_SIZE, 0) == -1) {
+        std::cerr << "Error sending stats request: " << strerror(errno) << "\n";
+        return;
+    }
+
+    buffer.resize(HEADER_BYTE_SIZE);
+    if (recv(sockfd, buffer.data(), HEADER_BYTE_SIZE, MSG_WAITALL) != HEADER_BYTE_SIZE) {
+        std::cerr << "Error receiving stats response header: " << strerror(errno) << "\n";
+        return;
+    }
+    deserialize_header(header, buffer.data());
+
+    buffer.resize(header.message_size);
+    ssize_t body_size = header.message_size - HEADER_BYTE_SIZE;
+    if (header.message_type != STATS_RESPONSE_TYPE ||
+        recv(sockfd, &buffer[HEADER_BYTE_SIZE], body_size, MSG_WAITALL) != body_size) {
+        std::cerr << "Error receiving stats response: " << strerror(errno) << "\n";
+        return;
+    }
+
+    StatsResponse response;
+    deserialize_stats_response(response, buffer.data());
+    std::cout << response.text;
+}
 
 int main(int argc, char* argv[]) {
     const char* server_ip = (argc > 1) ? argv[1] : DEFAULT_SERVER_IP;
@@ -108,11 +252,25 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    if (argc > 3 && strcmp(argv[3], "--stats") == 0) {
+        request_stats(sockfd);
+        close(sockfd);
+        return 0;
+    }
+
     UserCredentials credentials = {"admin", "12345"};
     login(sockfd, credentials);
 
+    if (argc > 4 && strcmp(argv[3], "--stream") == 0) {
+        bool verified = send_echo_stream_request(sockfd, credentials, static_cast<uint32_t>(strtoul(argv[4], nullptr, 10)));
+        close(sockfd);
+        return verified ? 0 : 1;
+    }
+
     send_echo_request(sockfd, credentials, "Hello, server!");
 
+    send_echo_batch_request(sockfd, credentials, {"Several", "messages", "in one frame"});
+
     getc(stdin);
 
     send_echo_request(sockfd, credentials, "Bye, server!");
@@ -1,4 +1,10 @@
 #include "common.hpp"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ECHO_CIPHER_X86 1
+#endif
 
 
 uint8_t* serialize_header(const Header& header, uint8_t* buffer) {
@@ -105,34 +111,390 @@ const uint8_t* deserialize_echo_response(EchoResponse& response, const uint8_t*
     return advanced_ptr + response.message_size;
 }
 
-uint32_t next_key(uint32_t key) {
-return (key * 1103515245 + 12345) % 0x7FFFFFFF;
+// Like the response counterpart below, a request whose payload was
+// encrypted in place right after the header is serialized without a copy.
+uint8_t* serialize_echo_request(const EchoRequestView& request, uint8_t* buffer) {
+    uint8_t* bufferHead = serialize_header(request.header, buffer);
+    uint16_t netmessage_size = htons(request.message_size);
+
+    bufferHead[0] = netmessage_size & 0xFF;
+    bufferHead[1] = (netmessage_size >> 8) & 0xFF;
+    uint8_t* message = bufferHead + sizeof(uint16_t);
+    if (reinterpret_cast<const uint8_t*>(request.cipher_message.data()) != message) {
+        memmove(message, request.cipher_message.data(), request.cipher_message.size());
+    }
+
+    return message + request.cipher_message.size();
+}
+
+const uint8_t* deserialize_echo_request(EchoRequestView& request, const uint8_t* buffer) {
+    const uint8_t* bufferHead = deserialize_header(request.header, buffer);
+    request.message_size = ntohs(bufferHead[0] | (bufferHead[1] << 8));
+    bufferHead += sizeof(uint16_t);
+
+    request.cipher_message = std::string_view(reinterpret_cast<const char*>(bufferHead), request.message_size);
+
+    return bufferHead + request.message_size;
+}
+
+// The payload is only moved when it does not already sit right after the
+// header, so a response built in place over its request costs no copy.
+uint8_t* serialize_echo_response(const EchoResponseView& response, uint8_t* buffer) {
+    uint8_t* advanced_ptr = serialize_header(response.header, buffer);
+    uint16_t netmessage_size = htons(response.message_size);
+
+    advanced_ptr[0] = netmessage_size & 0xFF;
+    advanced_ptr[1] = (netmessage_size >> 8) & 0xFF;
+    uint8_t* message = advanced_ptr + sizeof(uint16_t);
+    if (reinterpret_cast<const uint8_t*>(response.plain_message.data()) != message) {
+        memmove(message, response.plain_message.data(), response.plain_message.size());
+    }
+
+    return message + response.plain_message.size();
+}
+
+const uint8_t* deserialize_echo_response(EchoResponseView& response, const uint8_t* buffer) {
+    const uint8_t* advanced_ptr = deserialize_header(response.header, buffer);
+    response.message_size = ntohs(advanced_ptr[0] | (advanced_ptr[1] << 8));
+    advanced_ptr += sizeof(uint16_t);
+
+    response.plain_message = std::string_view(reinterpret_cast<const char*>(advanced_ptr), response.message_size);
+
+    return advanced_ptr + response.message_size;
+}
+
+uint8_t* serialize_stats_response(const StatsResponse& response, uint8_t* buffer) {
+    uint8_t* advanced_ptr = serialize_header(response.header, buffer);
+    uint16_t netmessage_size = htons(response.message_size);
+
+    advanced_ptr[0] = netmessage_size & 0xFF;
+    advanced_ptr[1] = (netmessage_size >> 8) & 0xFF;
+    memcpy(advanced_ptr + sizeof(uint16_t), response.text.data(), response.text.size());
+
+    return advanced_ptr + sizeof(uint16_t) + response.text.size();
+}
+
+const uint8_t* deserialize_stats_response(StatsResponse& response, const uint8_t* buffer) {
+    const uint8_t* advanced_ptr = deserialize_header(response.header, buffer);
+    response.message_size = ntohs(advanced_ptr[0] | (advanced_ptr[1] << 8));
+    advanced_ptr += sizeof(uint16_t);
+
+    response.text.assign(reinterpret_cast<const char*>(advanced_ptr), response.message_size);
+
+    return advanced_ptr + response.message_size;
+}
+
+static uint8_t* serialize_echo_batch(const Header& header, const std::vector<EchoBatchEntry>& messages, uint8_t* buffer) {
+    uint8_t* advanced_ptr = serialize_header(header, buffer);
+    uint16_t netcount = htons(static_cast<uint16_t>(messages.size()));
+
+    advanced_ptr[0] = netcount & 0xFF;
+    advanced_ptr[1] = (netcount >> 8) & 0xFF;
+    advanced_ptr += sizeof(uint16_t);
+    for (const EchoBatchEntry& message : messages) {
+        EchoBatchEntryView entry = {message.message_sequence, static_cast<uint16_t>(message.message.size()), message.message};
+        advanced_ptr = serialize_echo_batch_entry(entry, advanced_ptr);
+    }
+
+    return advanced_ptr;
+}
+
+static const uint8_t* deserialize_echo_batch(Header& header, std::vector<EchoBatchEntry>& messages, const uint8_t* buffer) {
+    const uint8_t* advanced_ptr = deserialize_header(header, buffer);
+    uint16_t count;
+    advanced_ptr = deserialize_echo_batch_count(count, advanced_ptr);
+
+    messages.resize(count);
+    for (EchoBatchEntry& message : messages) {
+        EchoBatchEntryView entry;
+        advanced_ptr = deserialize_echo_batch_entry(entry, advanced_ptr);
+        message.message_sequence = entry.message_sequence;
+        message.message.assign(entry.message.data(), entry.message.size());
+    }
+
+    return advanced_ptr;
+}
+
+uint8_t* serialize_echo_batch_request(const EchoBatchRequest& request, uint8_t* buffer) {
+    return serialize_echo_batch(request.header, request.messages, buffer);
+}
+
+uint8_t* serialize_echo_batch_response(const EchoBatchResponse& response, uint8_t* buffer) {
+    return serialize_echo_batch(response.header, response.messages, buffer);
+}
+
+const uint8_t* deserialize_echo_batch_request(EchoBatchRequest& request, const uint8_t* buffer) {
+    return deserialize_echo_batch(request.header, request.messages, buffer);
+}
+
+const uint8_t* deserialize_echo_batch_response(EchoBatchResponse& response, const uint8_t* buffer) {
+    return deserialize_echo_batch(response.header, response.messages, buffer);
+}
+
+const uint8_t* deserialize_echo_batch_count(uint16_t& count, const uint8_t* buffer) {
+    count = ntohs(buffer[0] | (buffer[1] << 8));
+
+    return buffer + sizeof(uint16_t);
+}
+
+// As with the single echo views, a payload that already sits right after
+// its entry header is not moved, so a batch can be rewritten in place.
+uint8_t* serialize_echo_batch_entry(const EchoBatchEntryView& entry, uint8_t* buffer) {
+    uint16_t netmessage_size = htons(entry.message_size);
+
+    buffer[0] = entry.message_sequence;
+    buffer[1] = netmessage_size & 0xFF;
+    buffer[2] = (netmessage_size >> 8) & 0xFF;
+    uint8_t* message = buffer + ECHO_BATCH_ENTRY_HEADER_BYTE_SIZE;
+    if (reinterpret_cast<const uint8_t*>(entry.message.data()) != message) {
+        memmove(message, entry.message.data(), entry.message.size());
+    }
+
+    return message + entry.message.size();
+}
+
+const uint8_t* deserialize_echo_batch_entry(EchoBatchEntryView& entry, const uint8_t* buffer) {
+    entry.message_sequence = buffer[0];
+    entry.message_size = ntohs(buffer[1] | (buffer[2] << 8));
+    const uint8_t* message = buffer + ECHO_BATCH_ENTRY_HEADER_BYTE_SIZE;
+
+    entry.message = std::string_view(reinterpret_cast<const char*>(message), entry.message_size);
+
+    return message + entry.message_size;
+}
+
+uint8_t* serialize_echo_stream_header(const EchoStreamHeader& header, uint8_t* buffer) {
+    uint8_t* advanced_ptr = serialize_header(header.header, buffer);
+    uint32_t netmessage_size = htonl(header.message_size);
+
+    advanced_ptr[0] = netmessage_size & 0xFF;
+    advanced_ptr[1] = (netmessage_size >> 8) & 0xFF;
+    advanced_ptr[2] = (netmessage_size >> 16) & 0xFF;
+    advanced_ptr[3] = (netmessage_size >> 24) & 0xFF;
+
+    return advanced_ptr + STREAM_SIZE_BYTE_SIZE;
+}
+
+const uint8_t* deserialize_echo_stream_header(EchoStreamHeader& header, const uint8_t* buffer) {
+    const uint8_t* advanced_ptr = deserialize_header(header.header, buffer);
+    header.message_size = ntohl(advanced_ptr[0] | (advanced_ptr[1] << 8) | (advanced_ptr[2] << 16) |
+                                (static_cast<uint32_t>(advanced_ptr[3]) << 24));
+
+    return advanced_ptr + STREAM_SIZE_BYTE_SIZE;
+}
+
+uint8_t* serialize_resume_request(const ResumeRequest& request, uint8_t* buffer) {
+    uint8_t* advanced_ptr = serialize_header(request.header, buffer);
+    memcpy(advanced_ptr, request.ticket.bytes, RESUME_TICKET_BYTE_SIZE);
+
+    return advanced_ptr + RESUME_TICKET_BYTE_SIZE;
+}
+
+const uint8_t* deserialize_resume_request(ResumeRequest& request, const uint8_t* buffer) {
+    const uint8_t* advanced_ptr = deserialize_header(request.header, buffer);
+    memcpy(request.ticket.bytes, advanced_ptr, RESUME_TICKET_BYTE_SIZE);
+
+    return advanced_ptr + RESUME_TICKET_BYTE_SIZE;
 }
 
-uint8_t calculate_check_sum(const std::string& text) {
+// Size of the whole frame, for the header's message_size. The caller keeps
+// it within UINT16_MAX.
+uint16_t echo_batch_frame_size(const std::vector<EchoBatchEntry>& messages) {
+    size_t size = ECHO_BATCH_HEADER_BYTE_SIZE;
+    for (const EchoBatchEntry& message : messages) {
+        size += ECHO_BATCH_ENTRY_HEADER_BYTE_SIZE + message.message.size();
+    }
+    return static_cast<uint16_t>(size);
+}
+
+// Same as (key * 1103515245 + 12345) % 0x7FFFFFFF. The product wraps at
+// 2^32 before the reduction, which is what keeps the generator from being
+// affine (and from supporting jump-ahead). Since 2^31 == 1 mod 0x7FFFFFFF,
+// the remainder folds the top bit back in without a division.
+inline uint32_t next_key(uint32_t key) {
+    uint32_t x = key * 1103515245u + 12345u;
+    uint32_t r = (x & 0x7FFFFFFF) + (x >> 31);
+    return r >= 0x7FFFFFFF ? r - 0x7FFFFFFF : r;
+}
+
+uint8_t calculate_check_sum(const char* text, size_t max_size) {
     uint8_t checksum = 0;
-    for (char ch : text) {
-        checksum += static_cast<uint8_t>(ch);
+    for (size_t i = 0; i < max_size && text[i] != '\0'; ++i) {
+        checksum += static_cast<uint8_t>(text[i]);
     }
     return ~checksum;
 }
 
-std::string encrypt_echo_message(const UserCredentials &credentials, uint8_t message_sequence, const std::string& cipher_text) {
-    uint8_t username_sum = calculate_check_sum(credentials.username);
-    uint8_t password_sum = calculate_check_sum(credentials.password);
-    uint32_t key = (static_cast<uint32_t>(message_sequence) << 16) | (static_cast<uint32_t>(username_sum) << 8) | password_sum;
+EchoKey derive_echo_key(const UserCredentials& credentials) {
+    return {calculate_check_sum(credentials.username, USER_BYTE_SIZE), calculate_check_sum(credentials.password, PASS_BYTE_SIZE)};
+}
+
+uint32_t echo_cipher_seed(const EchoKey& key, uint8_t message_sequence) {
+    return (static_cast<uint32_t>(message_sequence) << 16) | (static_cast<uint32_t>(key.username_sum) << 8) | key.password_sum;
+}
 
-    std::string plain_text;
-    plain_text.reserve(cipher_text.size());
+void generate_keystream(uint32_t& key, uint8_t* keystream, size_t size) {
+    uint32_t state = key;
+    for (size_t i = 0; i < size; ++i) {
+        state = next_key(state);
+        keystream[i] = static_cast<uint8_t>(state & 0xFF);
+    }
+    key = state;
+}
+
+typedef void (*XorKernel)(const uint8_t* input, const uint8_t* keystream, uint8_t* output, size_t size);
 
-    for (char ch : cipher_text) {
-        key = next_key(key); 
-        plain_text.push_back(ch ^ static_cast<uint8_t>(key % 256));
+static void xor_scalar(const uint8_t* input, const uint8_t* keystream, uint8_t* output, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        output[i] = input[i] ^ keystream[i];
     }
+}
 
+#ifdef ECHO_CIPHER_X86
+__attribute__((target("sse2")))
+static void xor_sse2(const uint8_t* input, const uint8_t* keystream, uint8_t* output, size_t size) {
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+        __m128i key = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keystream + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_xor_si128(data, key));
+    }
+    xor_scalar(input + i, keystream + i, output + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static void xor_avx2(const uint8_t* input, const uint8_t* keystream, uint8_t* output, size_t size) {
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input + i));
+        __m256i key = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keystream + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(output + i), _mm256_xor_si256(data, key));
+    }
+    // The tail runs legacy-encoded SSE; leaving the upper YMM halves dirty
+    // makes every one of those instructions pay an AVX-SSE transition.
+    _mm256_zeroupper();
+    xor_sse2(input + i, keystream + i, output + i, size - i);
+}
+#endif
+
+struct XorKernelChoice {
+    XorKernel kernel;
+    const char* name;
+};
+
+// Every kernel, fastest first. A null kernel is one this build cannot run.
+static std::vector<XorKernelChoice> detect_xor_kernels() {
+    std::vector<XorKernelChoice> kernels;
+    #ifdef ECHO_CIPHER_X86
+    __builtin_cpu_init();
+    kernels.push_back({__builtin_cpu_supports("avx2") ? xor_avx2 : nullptr, "avx2"});
+    kernels.push_back({__builtin_cpu_supports("sse2") ? xor_sse2 : nullptr, "sse2"});
+    #endif
+    kernels.push_back({xor_scalar, "scalar"});
+    return kernels;
+}
+
+static const std::vector<XorKernelChoice> xor_kernels = detect_xor_kernels();
+
+static XorKernelChoice select_xor_kernel() {
+    for (const XorKernelChoice& choice : xor_kernels) {
+        if (choice.kernel != nullptr) {
+            return choice;
+        }
+    }
+    return {xor_scalar, "scalar"};
+}
+
+static XorKernelChoice xor_kernel = select_xor_kernel();
+
+void xor_keystream(const uint8_t* input, const uint8_t* keystream, uint8_t* output, size_t size) {
+    xor_kernel.kernel(input, keystream, output, size);
+}
+
+const char* xor_kernel_name() {
+    return xor_kernel.name;
+}
+
+std::vector<std::string> available_xor_kernels() {
+    std::vector<std::string> names;
+    for (const XorKernelChoice& choice : xor_kernels) {
+        if (choice.kernel != nullptr) {
+            names.push_back(choice.name);
+        }
+    }
+    return names;
+}
+
+bool use_xor_kernel(const std::string& name) {
+    for (const XorKernelChoice& choice : xor_kernels) {
+        if (choice.kernel != nullptr && name == choice.name) {
+            xor_kernel = choice;
+            return true;
+        }
+    }
+    return false;
+}
+
+// The generator is serial, so the keystream is produced a block at a time
+// into a small stack buffer and then XORed with the vector kernel.
+// input and output may alias.
+void apply_echo_cipher(uint32_t seed, const uint8_t* input, uint8_t* output, size_t size) {
+    uint32_t key = seed;
+    apply_echo_cipher_stream(key, input, output, size);
+}
+
+// Continues the keystream from key and leaves key where this part ended,
+// so a message can be processed in consecutive parts of any size.
+void apply_echo_cipher_stream(uint32_t& key, const uint8_t* input, uint8_t* output, size_t size) {
+    uint8_t keystream[KEYSTREAM_BLOCK_SIZE];
+    for (size_t offset = 0; offset < size; offset += KEYSTREAM_BLOCK_SIZE) {
+        size_t block = std::min(KEYSTREAM_BLOCK_SIZE, size - offset);
+        generate_keystream(key, keystream, block);
+        xor_keystream(input + offset, keystream, output + offset, block);
+    }
+}
+
+std::string encrypt_echo_message(const EchoKey& key, uint8_t message_sequence, const std::string& cipher_text) {
+    std::string plain_text(cipher_text.size(), '\0');
+    apply_echo_cipher(echo_cipher_seed(key, message_sequence), reinterpret_cast<const uint8_t*>(cipher_text.data()),
+                      reinterpret_cast<uint8_t*>(&plain_text[0]), cipher_text.size());
     return plain_text;
 }
 
+std::string encrypt_echo_message(const UserCredentials &credentials, uint8_t message_sequence, const std::string& cipher_text) {
+    return encrypt_echo_message(derive_echo_key(credentials), message_sequence, cipher_text);
+}
+
+void KeystreamCache::apply(uint32_t seed, const uint8_t* input, uint8_t* output, size_t size) {
+    if (entries.empty()) {
+        entries.assign(KEYSTREAM_CACHE_SLOTS, {0, 0, 0});
+        keystreams.resize(KEYSTREAM_CACHE_SLOTS * KEYSTREAM_PREFIX_SIZE);
+    }
+
+    size_t slot = ((seed * 2654435761u) >> 16) & (KEYSTREAM_CACHE_SLOTS - 1);
+    Entry& entry = entries[slot];
+    uint8_t* keystream = &keystreams[slot * KEYSTREAM_PREFIX_SIZE];
+
+    if (entry.length == 0 || entry.seed != seed) {
+        entry = {seed, seed, 0};
+        ++miss_count;
+    } else {
+        ++hit_count;
+    }
+
+    // Extend the cached prefix only as far as this message needs it.
+    size_t prefix = std::min(size, KEYSTREAM_PREFIX_SIZE);
+    if (entry.length < prefix) {
+        generate_keystream(entry.key, keystream + entry.length, prefix - entry.length);
+        entry.length = prefix;
+    }
+
+    xor_keystream(input, keystream, output, prefix);
+    if (size > prefix) {
+        apply_echo_cipher(entry.key, input + prefix, output + prefix, size - prefix);
+    }
+}
+
 #ifndef NDEBUG
 
 int indent_level = 0;
@@ -201,4 +563,13 @@ void print_echo_response(const EchoResponse& response) {
     std::cout << getIndent() << "Plain Message: " << response.plain_message << std::endl;
     decreaseIndent();
 }
+
+void print_echo_response(const EchoResponseView& response) {
+    std::cout << getIndent() << "Echo Response:" << std::endl;
+    increaseIndent();
+    print_header(response.header);
+    std::cout << getIndent() << "Message Size: " << response.message_size << std::endl;
+    std::cout << getIndent() << "Plain Message: " << response.plain_message << std::endl;
+    decreaseIndent();
+}
 #endif
\ No newline at end of file
@@ -1,3 +1,6 @@
+#ifndef COMMON_HPP
+#define COMMON_HPP
+
 #include <iostream>
 #include <unistd.h>
 #include <cstring>
@@ -5,6 +8,7 @@
 #include <sys/socket.h>
 #include <netdb.h>
 #include <string>
+#include <string_view>
 #include <vector>
 
 const char DEFAULT_PORT[] = "8080";
@@ -13,6 +17,14 @@ const uint8_t LOGIN_REQUEST_TYPE = 0;
 const uint8_t LOGIN_RESPONSE_TYPE = 1;
 const uint8_t ECHO_REQUEST_TYPE = 2;
 const uint8_t ECHO_RESPONSE_TYPE = 3;
+const uint8_t STATS_REQUEST_TYPE = 4;
+const uint8_t STATS_RESPONSE_TYPE = 5;
+const uint8_t ECHO_BATCH_REQUEST_TYPE = 6;
+const uint8_t ECHO_BATCH_RESPONSE_TYPE = 7;
+const uint8_t ECHO_STREAM_REQUEST_TYPE = 8;
+const uint8_t ECHO_STREAM_RESPONSE_TYPE = 9;
+const uint8_t RESUME_REQUEST_TYPE = 10;
+const uint8_t RESUME_RESPONSE_TYPE = 11;
 
 const uint16_t HEADER_BYTE_SIZE = 4;
 const uint16_t SIZE_BYTE_SIZE = 2;
@@ -21,6 +33,23 @@ const uint16_t PASS_BYTE_SIZE = 32;
 const uint16_t USER_CREDENTIALS_BYTE_SIZE = USER_BYTE_SIZE + PASS_BYTE_SIZE;
 const uint16_t LOGIN_REQUEST_BYTE_SIZE = HEADER_BYTE_SIZE + USER_CREDENTIALS_BYTE_SIZE;
 const uint16_t LOGIN_RESPONSE_BYTE_SIZE = HEADER_BYTE_SIZE + SIZE_BYTE_SIZE;
+const uint16_t STATS_REQUEST_BYTE_SIZE = HEADER_BYTE_SIZE;
+const uint16_t MAX_STATS_TEXT_SIZE = UINT16_MAX - HEADER_BYTE_SIZE - SIZE_BYTE_SIZE;
+const uint16_t ECHO_BATCH_HEADER_BYTE_SIZE = HEADER_BYTE_SIZE + SIZE_BYTE_SIZE;
+const uint16_t ECHO_BATCH_ENTRY_HEADER_BYTE_SIZE = 1 + SIZE_BYTE_SIZE;
+const uint16_t STREAM_SIZE_BYTE_SIZE = 4;
+const uint16_t ECHO_STREAM_HEADER_BYTE_SIZE = HEADER_BYTE_SIZE + STREAM_SIZE_BYTE_SIZE;
+const uint16_t RESUME_TICKET_BYTE_SIZE = 34;
+const uint16_t RESUME_REQUEST_BYTE_SIZE = HEADER_BYTE_SIZE + RESUME_TICKET_BYTE_SIZE;
+const uint16_t LOGIN_RESPONSE_TICKET_BYTE_SIZE = LOGIN_RESPONSE_BYTE_SIZE + RESUME_TICKET_BYTE_SIZE;
+
+// Login response status codes. A failed login gets no response: the server
+// closes the connection. BUSY means the server was too loaded to check the
+// credentials at all; the connection stays open and the login can be
+// retried.
+const uint16_t LOGIN_STATUS_FAILED = 0;
+const uint16_t LOGIN_STATUS_OK = 1;
+const uint16_t LOGIN_STATUS_BUSY = 2;
 
 struct Header {
     uint16_t message_size;
@@ -44,6 +73,23 @@ struct LoginResponse {
     uint16_t status_code;
 };
 
+// A server with resumption enabled appends a ticket to every successful
+// login response, whose message_size is then LOGIN_RESPONSE_TICKET_BYTE_SIZE.
+// The ticket is opaque to the client. Sent as the first frame of a new
+// connection, it stands in for the login, so echoes can follow it in the
+// same write without waiting for an answer. The resume response has the
+// same layout as a ticketed login response and carries a fresh ticket. A
+// ticket that is invalid or has expired gets no answer: the server closes
+// the connection, and the client falls back to a full login.
+struct ResumeTicket {
+    uint8_t bytes[RESUME_TICKET_BYTE_SIZE];
+};
+
+struct ResumeRequest {
+    Header header;
+    ResumeTicket ticket;
+};
+
 struct EchoRequest {
     Header header;
     uint16_t message_size;
@@ -56,13 +102,118 @@ struct EchoResponse {
     std::string plain_message;
 };
 
+// A stats request is a bare header. The response carries the server's
+// counters and latency histograms as "name value" text lines.
+struct StatsResponse {
+    Header header;
+    uint16_t message_size;
+    std::string text;
+};
+
+// A batch frame is the header, a uint16 message count, then per message its
+// own sequence, a uint16 size and the payload. The header's message_size is
+// the size of the whole frame. Each message is encrypted with its own
+// sequence, and the response has the same layout with the payloads
+// decrypted, so it is exactly as large as the request.
+struct EchoBatchEntry {
+    uint8_t message_sequence;
+    std::string message;
+};
+
+struct EchoBatchRequest {
+    Header header;
+    std::vector<EchoBatchEntry> messages;
+};
+
+struct EchoBatchResponse {
+    Header header;
+    std::vector<EchoBatchEntry> messages;
+};
+
+// A stream frame lifts the 64 KB limit: the header, whose message_size
+// covers only the header itself and the uint32 payload size after it, is
+// followed by message_size raw payload bytes. The payload is encrypted as
+// one keystream seeded from the sequence, exactly like an echo message of
+// that length, so it can be decrypted in chunks as it arrives. The
+// response starts with a stream header of the same size and streams the
+// plaintext back.
+struct EchoStreamHeader {
+    Header header;
+    uint32_t message_size;
+};
+
+// Non-owning counterparts of EchoRequest/EchoResponse. The message views
+// point into the buffer the frame was decoded from, so the hot path can
+// decode, decrypt and re-encode a frame without copying the payload.
+struct EchoRequestView {
+    Header header;
+    uint16_t message_size;
+    std::string_view cipher_message;
+};
+
+struct EchoResponseView {
+    Header header;
+    uint16_t message_size;
+    std::string_view plain_message;
+};
+
+struct EchoBatchEntryView {
+    uint8_t message_sequence;
+    uint16_t message_size;
+    std::string_view message;
+};
+
+// Credential checksums that, together with the message sequence, seed the
+// echo cipher. They never change during a session, so derive them once at
+// login instead of on every message.
+struct EchoKey {
+    uint8_t username_sum;
+    uint8_t password_sum;
+};
+
+const size_t KEYSTREAM_CACHE_SLOTS = 1024;
+const size_t KEYSTREAM_PREFIX_SIZE = 512;
+const size_t KEYSTREAM_BLOCK_SIZE = 256;
+
+// Direct-mapped cache of keystream prefixes keyed by the 24-bit cipher seed.
+// Repeated seeds XOR against the stored prefix instead of re-running the
+// generator; bytes past KEYSTREAM_PREFIX_SIZE continue from the saved state.
+// Not thread-safe: give each thread its own instance.
+class KeystreamCache {
+public:
+    void apply(uint32_t seed, const uint8_t* input, uint8_t* output, size_t size);
+
+    uint64_t hits() const { return hit_count; }
+    uint64_t misses() const { return miss_count; }
+
+private:
+    struct Entry {
+        uint32_t seed;
+        uint32_t key;
+        uint16_t length;
+    };
+
+    std::vector<Entry> entries;
+    std::vector<uint8_t> keystreams;
+    uint64_t hit_count = 0;
+    uint64_t miss_count = 0;
+};
+
 
 uint8_t* serialize_header(const Header& header, uint8_t* buffer);
 uint8_t* serialize_user_credentials(const UserCredentials& credentials, uint8_t* buffer);
 uint8_t* serialize_login_request(const LoginRequest& request, uint8_t* buffer);
 uint8_t* serialize_login_response(const LoginResponse& response, uint8_t* buffer);
 uint8_t* serialize_echo_request(const EchoRequest& request, uint8_t* buffer);
+uint8_t* serialize_echo_request(const EchoRequestView& request, uint8_t* buffer);
 uint8_t* serialize_echo_response(const EchoResponse& response, uint8_t* buffer);
+uint8_t* serialize_echo_response(const EchoResponseView& response, uint8_t* buffer);
+uint8_t* serialize_stats_response(const StatsResponse& response, uint8_t* buffer);
+uint8_t* serialize_echo_batch_request(const EchoBatchRequest& request, uint8_t* buffer);
+uint8_t* serialize_echo_batch_response(const EchoBatchResponse& response, uint8_t* buffer);
+uint8_t* serialize_echo_batch_entry(const EchoBatchEntryView& entry, uint8_t* buffer);
+uint8_t* serialize_echo_stream_header(const EchoStreamHeader& header, uint8_t* buffer);
+uint8_t* serialize_resume_request(const ResumeRequest& request, uint8_t* buffer);
 
 const uint8_t* deserialize_header(Header& header, const uint8_t* buffer);
 const uint8_t* deserialize_user_credentials(UserCredentials& credentials, const uint8_t* buffer);
@@ -70,7 +221,30 @@ const uint8_t* deserialize_login_request(LoginRequest& request, const uint8_t* b
 const uint8_t* deserialize_login_response(LoginResponse& response, const uint8_t* buffer);
 const uint8_t* deserialize_echo_request(EchoRequest& request, const uint8_t* buffer);
 const uint8_t* deserialize_echo_response(EchoResponse& response, const uint8_t* buffer);
+const uint8_t* deserialize_echo_request(EchoRequestView& request, const uint8_t* buffer);
+const uint8_t* deserialize_echo_response(EchoResponseView& response, const uint8_t* buffer);
+const uint8_t* deserialize_stats_response(StatsResponse& response, const uint8_t* buffer);
+const uint8_t* deserialize_echo_batch_request(EchoBatchRequest& request, const uint8_t* buffer);
+const uint8_t* deserialize_echo_batch_response(EchoBatchResponse& response, const uint8_t* buffer);
+const uint8_t* deserialize_echo_batch_count(uint16_t& count, const uint8_t* buffer);
+const uint8_t* deserialize_echo_batch_entry(EchoBatchEntryView& entry, const uint8_t* buffer);
+uint16_t echo_batch_frame_size(const std::vector<EchoBatchEntry>& messages);
+const uint8_t* deserialize_echo_stream_header(EchoStreamHeader& header, const uint8_t* buffer);
+const uint8_t* deserialize_resume_request(ResumeRequest& request, const uint8_t* buffer);
 
+EchoKey derive_echo_key(const UserCredentials& credentials);
+uint32_t echo_cipher_seed(const EchoKey& key, uint8_t message_sequence);
+void generate_keystream(uint32_t& key, uint8_t* keystream, size_t size);
+void xor_keystream(const uint8_t* input, const uint8_t* keystream, uint8_t* output, size_t size);
+const char* xor_kernel_name();
+// Kernels this CPU can run, fastest first. use_xor_kernel switches
+// xor_keystream to one of them, for tests; it is not safe while another
+// thread is ciphering. Returns false for a kernel this CPU cannot run.
+std::vector<std::string> available_xor_kernels();
+bool use_xor_kernel(const std::string& name);
+void apply_echo_cipher(uint32_t seed, const uint8_t* input, uint8_t* output, size_t size);
+void apply_echo_cipher_stream(uint32_t& key, const uint8_t* input, uint8_t* output, size_t size);
+std::string encrypt_echo_message(const EchoKey& key, uint8_t message_sequence, const std::string& cipher_text);
 std::string encrypt_echo_message(const UserCredentials &credentials, uint8_t message_sequence, const std::string& cipher_text);
 
 #ifndef NDEBUG
@@ -80,4 +254,7 @@ void print_login_request(const LoginRequest& request);
 void print_login_response(const LoginResponse& response);
 void print_echo_request(const EchoRequest& request);
 void print_echo_response(const EchoResponse& response);
-#endif
\ No newline at end of file
+void print_echo_response(const EchoResponseView& response);
+#endif
+
+#endif
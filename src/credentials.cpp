@@ -0,0 +1,308 @@
+#include "credentials.hpp"
+#include "sha256.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <random>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Displacements tried for one bucket before giving up on the seed and
+// building the whole index again with another. Only a pathological seed
+// gets anywhere near it.
+const uint32_t MAX_DISPLACEMENT = 1 << 20;
+
+void hash_credential_secret(const uint8_t* salt, const char* password, uint8_t* digest) {
+    uint8_t input[CREDENTIAL_SALT_SIZE + PASS_BYTE_SIZE];
+    memcpy(input, salt, CREDENTIAL_SALT_SIZE);
+    memcpy(input + CREDENTIAL_SALT_SIZE, password, PASS_BYTE_SIZE);
+    sha256(input, sizeof input, digest);
+}
+
+// splitmix64's finalizer, applied after folding in each 8-byte word.
+static uint64_t mix(uint64_t value) {
+    value += 0x9e3779b97f4a7c15;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+    return value ^ (value >> 31);
+}
+
+uint64_t credential_hash(const char* username, uint64_t seed) {
+    uint64_t hash = seed;
+    for (size_t i = 0; i < USER_BYTE_SIZE; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, username + i, sizeof word);
+        hash = mix(hash ^ word);
+    }
+    return hash;
+}
+
+// Maps a hash onto [0, range) with a multiply instead of a division.
+static uint32_t scale(uint64_t hash, uint32_t range) {
+    return static_cast<uint32_t>((static_cast<unsigned __int128>(hash) * range) >> 64);
+}
+
+CredentialStore::~CredentialStore() {
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_size);
+    }
+}
+
+bool CredentialStore::open(const char* path, std::string& error) {
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        error = strerror(errno);
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) == -1) {
+        error = strerror(errno);
+        close(fd);
+        return false;
+    }
+    size_t size = static_cast<size_t>(status.st_size);
+    if (size < sizeof(CredentialFileHeader)) {
+        error = "not a credential file";
+        close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        error = strerror(errno);
+        return false;
+    }
+
+    const CredentialFileHeader* header = static_cast<const CredentialFileHeader*>(mapped);
+    if (memcmp(header->magic, CREDENTIAL_FILE_MAGIC, sizeof header->magic) != 0) {
+        error = "not a credential file";
+    } else if (header->version != CREDENTIAL_FILE_VERSION) {
+        error = "unsupported credential file version " + std::to_string(header->version);
+    } else if (header->record_count > MAX_CREDENTIAL_RECORDS ||
+               sizeof(CredentialFileHeader) + size_t(header->bucket_count) * sizeof(uint32_t) +
+                       size_t(header->record_count) * sizeof(CredentialRecord) != size) {
+        error = "credential file is truncated or corrupt";
+    } else {
+        error.clear();
+    }
+    if (!error.empty()) {
+        munmap(mapped, size);
+        return false;
+    }
+
+    // Lookups land anywhere in the file, so readahead would only fill the
+    // page cache with records nobody asked for.
+    madvise(mapped, size, MADV_RANDOM);
+
+    if (mapping != nullptr) {
+        munmap(mapping, mapping_size);
+    }
+    mapping = mapped;
+    mapping_size = size;
+    seed = header->seed;
+    record_count = header->record_count;
+    bucket_count = header->bucket_count;
+    index = reinterpret_cast<const uint32_t*>(header + 1);
+    records = reinterpret_cast<const CredentialRecord*>(index + bucket_count);
+    return true;
+}
+
+const CredentialRecord* CredentialStore::find(const char* username) const {
+    if (record_count == 0 || bucket_count == 0) {
+        return nullptr;
+    }
+    uint32_t entry = index[scale(credential_hash(username, seed), bucket_count)];
+    uint32_t slot = (entry & CREDENTIAL_INDEX_DIRECT) != 0
+                        ? entry & ~CREDENTIAL_INDEX_DIRECT
+                        : scale(credential_hash(username, seed + entry), record_count);
+    if (slot >= record_count) {
+        return nullptr;
+    }
+    const CredentialRecord* record = &records[slot];
+    return memcmp(record->username, username, USER_BYTE_SIZE) == 0 ? record : nullptr;
+}
+
+bool CredentialStore::verify(const UserCredentials& credentials) const {
+    const CredentialRecord* record = find(credentials.username);
+    if (record == nullptr) {
+        return false;
+    }
+    uint8_t digest[CREDENTIAL_DIGEST_SIZE];
+    hash_credential_secret(record->salt, credentials.password, digest);
+
+    // Compared in constant time, so the time taken says nothing about how
+    // much of the digest matched.
+    uint8_t difference = 0;
+    for (size_t i = 0; i < CREDENTIAL_DIGEST_SIZE; ++i) {
+        difference |= digest[i] ^ record->digest[i];
+    }
+    return difference == 0;
+}
+
+enum class IndexBuild {
+    DONE,
+    RETRY,
+    DUPLICATE
+};
+
+// One bucket per record on average. Buckets with several records are
+// placed first, largest first while most slots are still free, by trying
+// displacements until all of their records hash to distinct free slots.
+// Single-record buckets then take the remaining slots directly.
+static IndexBuild build_index(const std::vector<CredentialRecord>& records, uint64_t seed,
+                              std::vector<uint32_t>& index, std::vector<uint32_t>& slot_records,
+                              std::string& duplicate) {
+    uint32_t record_count = static_cast<uint32_t>(records.size());
+    uint32_t bucket_count = static_cast<uint32_t>(index.size());
+
+    // Group the records by bucket with a counting sort.
+    std::vector<uint32_t> starts(bucket_count + 1, 0);
+    std::vector<uint32_t> members(record_count);
+    for (uint32_t i = 0; i < record_count; ++i) {
+        members[i] = scale(credential_hash(records[i].username, seed), bucket_count);
+        ++starts[members[i] + 1];
+    }
+    for (uint32_t bucket = 0; bucket < bucket_count; ++bucket) {
+        starts[bucket + 1] += starts[bucket];
+    }
+    {
+        std::vector<uint32_t> next(starts.begin(), starts.end() - 1);
+        std::vector<uint32_t> grouped(record_count);
+        for (uint32_t i = 0; i < record_count; ++i) {
+            grouped[next[members[i]]++] = i;
+        }
+        members.swap(grouped);
+    }
+
+    std::vector<uint32_t> order;
+    for (uint32_t bucket = 0; bucket < bucket_count; ++bucket) {
+        if (starts[bucket + 1] - starts[bucket] > 1) {
+            order.push_back(bucket);
+        }
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t left, uint32_t right) {
+        return starts[left + 1] - starts[left] > starts[right + 1] - starts[right];
+    });
+
+    std::vector<bool> taken(record_count, false);
+    std::vector<uint32_t> placed;
+    for (uint32_t bucket : order) {
+        uint32_t begin = starts[bucket];
+        uint32_t end = starts[bucket + 1];
+        // Equal usernames always share a bucket and a slot, so no
+        // displacement would ever separate them.
+        for (uint32_t i = begin; i < end; ++i) {
+            for (uint32_t j = i + 1; j < end; ++j) {
+                const char* username = records[members[i]].username;
+                if (memcmp(username, records[members[j]].username, USER_BYTE_SIZE) == 0) {
+                    duplicate.assign(username, strnlen(username, USER_BYTE_SIZE));
+                    return IndexBuild::DUPLICATE;
+                }
+            }
+        }
+
+        uint32_t displacement = 1;
+        for (;; ++displacement) {
+            if (displacement == MAX_DISPLACEMENT) {
+                return IndexBuild::RETRY;
+            }
+            placed.clear();
+            for (uint32_t i = begin; i < end; ++i) {
+                uint32_t slot = scale(credential_hash(records[members[i]].username, seed + displacement), record_count);
+                if (taken[slot] || std::find(placed.begin(), placed.end(), slot) != placed.end()) {
+                    break;
+                }
+                placed.push_back(slot);
+            }
+            if (placed.size() == end - begin) {
+                break;
+            }
+        }
+        for (uint32_t i = begin; i < end; ++i) {
+            taken[placed[i - begin]] = true;
+            slot_records[placed[i - begin]] = members[i];
+        }
+        index[bucket] = displacement;
+    }
+
+    // Empty buckets point at any record; the username check turns those
+    // lookups away.
+    uint32_t next_free = 0;
+    for (uint32_t bucket = 0; bucket < bucket_count; ++bucket) {
+        uint32_t size = starts[bucket + 1] - starts[bucket];
+        if (size == 0) {
+            index[bucket] = CREDENTIAL_INDEX_DIRECT;
+        } else if (size == 1) {
+            while (taken[next_free]) {
+                ++next_free;
+            }
+            taken[next_free] = true;
+            slot_records[next_free] = members[starts[bucket]];
+            index[bucket] = CREDENTIAL_INDEX_DIRECT | next_free;
+        }
+    }
+    return IndexBuild::DONE;
+}
+
+bool write_credential_file(const char* path, const std::vector<CredentialRecord>& records, std::string& error) {
+    if (records.size() > MAX_CREDENTIAL_RECORDS) {
+        error = "too many credentials";
+        return false;
+    }
+    uint32_t record_count = static_cast<uint32_t>(records.size());
+    std::vector<uint32_t> index(record_count);
+    std::vector<uint32_t> slot_records(record_count);
+
+    std::random_device random;
+    uint64_t seed;
+    while (true) {
+        seed = static_cast<uint64_t>(random()) << 32 | random();
+        std::string duplicate;
+        IndexBuild result = build_index(records, seed, index, slot_records, duplicate);
+        if (result == IndexBuild::DONE) {
+            break;
+        }
+        if (result == IndexBuild::DUPLICATE) {
+            error = "duplicate username " + duplicate;
+            return false;
+        }
+    }
+
+    CredentialFileHeader header;
+    memset(&header, 0, sizeof header);
+    memcpy(header.magic, CREDENTIAL_FILE_MAGIC, sizeof header.magic);
+    header.version = CREDENTIAL_FILE_VERSION;
+    header.record_count = record_count;
+    header.bucket_count = record_count;
+    header.seed = seed;
+
+    std::string temporary = std::string(path) + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (file == nullptr) {
+        error = temporary + ": " + strerror(errno);
+        return false;
+    }
+    bool written = fwrite(&header, sizeof header, 1, file) == 1 &&
+                   fwrite(index.data(), sizeof(uint32_t), index.size(), file) == index.size();
+    for (uint32_t slot = 0; written && slot < record_count; ++slot) {
+        written = fwrite(&records[slot_records[slot]], sizeof(CredentialRecord), 1, file) == 1;
+    }
+    written = written && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    int write_errno = errno;
+    if (fclose(file) != 0 && written) {
+        written = false;
+        write_errno = errno;
+    }
+    if (!written) {
+        error = temporary + ": " + strerror(write_errno);
+        unlink(temporary.c_str());
+        return false;
+    }
+    if (rename(temporary.c_str(), path) != 0) {
+        error = std::string(path) + ": " + strerror(errno);
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
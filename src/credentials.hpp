@@ -0,0 +1,93 @@
+#ifndef CREDENTIALS_HPP
+#define CREDENTIALS_HPP
+
+#include "common.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Credential file, built offline by mkcreds and mapped read-only by the
+// server. It is laid out in host byte order as
+//
+//   CredentialFileHeader
+//   uint32_t index[bucket_count]
+//   CredentialRecord records[record_count]
+//
+// The index is a minimal perfect hash over the usernames (hash and
+// displace). A username's bucket is credential_hash(username, seed) scaled
+// to bucket_count. An index entry with CREDENTIAL_INDEX_DIRECT set holds the
+// record slot itself; any other entry is a displacement d, and the slot is
+// credential_hash(username, seed + d) scaled to record_count. Every
+// username in the file lands on its own record. Any other name lands on
+// some record whose username does not match it.
+const char CREDENTIAL_FILE_MAGIC[8] = {'E', 'C', 'H', 'O', 'C', 'R', 'E', 'D'};
+const uint32_t CREDENTIAL_FILE_VERSION = 1;
+const size_t CREDENTIAL_SALT_SIZE = 16;
+const size_t CREDENTIAL_DIGEST_SIZE = 32;
+const uint32_t CREDENTIAL_INDEX_DIRECT = 0x80000000;
+const size_t MAX_CREDENTIAL_RECORDS = CREDENTIAL_INDEX_DIRECT - 1;
+
+struct CredentialFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_count;
+    uint32_t bucket_count;
+    uint32_t reserved;
+    uint64_t seed;
+};
+
+// Usernames and passwords are the zero-padded 32-byte fields of the login
+// request. digest is the SHA-256 of the salt followed by the password field.
+struct CredentialRecord {
+    char username[USER_BYTE_SIZE];
+    uint8_t salt[CREDENTIAL_SALT_SIZE];
+    uint8_t digest[CREDENTIAL_DIGEST_SIZE];
+};
+
+static_assert(sizeof(CredentialFileHeader) == 32, "credential file header layout");
+static_assert(sizeof(CredentialRecord) == 80, "credential record layout");
+
+uint64_t credential_hash(const char* username, uint64_t seed);
+void hash_credential_secret(const uint8_t* salt, const char* password, uint8_t* digest);
+
+// A credential file mapped read-only. Lookups hash the username straight
+// out of the login request and return a pointer into the mapping, so
+// opening even a very large file costs a header check, and each lookup
+// touches one index entry and one record. Safe to share between threads
+// once opened.
+class CredentialStore {
+public:
+    CredentialStore() = default;
+    ~CredentialStore();
+    CredentialStore(const CredentialStore&) = delete;
+    CredentialStore& operator=(const CredentialStore&) = delete;
+
+    // Returns false, describing why in error, if path is not a valid
+    // credential file.
+    bool open(const char* path, std::string& error);
+
+    size_t size() const { return record_count; }
+
+    // The record for username, a USER_BYTE_SIZE field, or nullptr.
+    const CredentialRecord* find(const char* username) const;
+
+    bool verify(const UserCredentials& credentials) const;
+
+private:
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+    uint64_t seed = 0;
+    uint32_t record_count = 0;
+    uint32_t bucket_count = 0;
+    const uint32_t* index = nullptr;
+    const CredentialRecord* records = nullptr;
+};
+
+// Builds the index over records and writes the file. It goes to a
+// temporary file that is renamed over path once complete, so a server
+// reloading path sees either the old file or the new one. Returns false,
+// describing why in error, on duplicate usernames or a failed write.
+bool write_credential_file(const char* path, const std::vector<CredentialRecord>& records, std::string& error);
+
+#endif
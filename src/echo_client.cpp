@@ -0,0 +1,470 @@
+#include "echo_client.hpp"
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+const size_t RECEIVE_CHUNK_SIZE = 64 * 1024;
+
+const char* echo_status_name(EchoStatus status) {
+    switch (status) {
+    case EchoStatus::OK:
+        return "ok";
+    case EchoStatus::REJECTED:
+        return "rejected";
+    case EchoStatus::CONNECT_FAILED:
+        return "connect failed";
+    case EchoStatus::LOGIN_FAILED:
+        return "login failed";
+    case EchoStatus::LOGIN_BUSY:
+        return "login busy";
+    case EchoStatus::CLOSED:
+        return "closed";
+    case EchoStatus::PROTOCOL_ERROR:
+        return "protocol error";
+    }
+    return "unknown";
+}
+
+// std::function needs a copyable target, so the promise is shared.
+static EchoCallback promise_callback(const std::shared_ptr<std::promise<EchoReply>>& promise) {
+    return [promise](EchoStatus status, std::string_view message) {
+        promise->set_value({status, std::string(message)});
+    };
+}
+
+EchoClient::~EchoClient() {
+    close();
+}
+
+bool EchoClient::connect(const struct addrinfo* address) {
+    close();
+
+    int fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+    if (fd == -1) {
+        return false;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+    if (::connect(fd, address->ai_addr, address->ai_addrlen) == -1 && errno != EINPROGRESS) {
+        int error = errno;
+        ::close(fd);
+        errno = error;
+        return false;
+    }
+
+    socket_fd = fd;
+    state = State::CONNECTING;
+    callbacks.resize(ECHO_CLIENT_MAX_IN_FLIGHT);
+    return true;
+}
+
+bool EchoClient::login(const UserCredentials& credentials, LoginCallback callback) {
+    if (state == State::CLOSED || login_queued) {
+        return false;
+    }
+
+    LoginRequest request = {{LOGIN_REQUEST_BYTE_SIZE, LOGIN_REQUEST_TYPE, 0}, credentials};
+    size_t offset = output.size();
+    output.resize(offset + LOGIN_REQUEST_BYTE_SIZE);
+    serialize_login_request(request, output.data() + offset);
+
+    key = derive_echo_key(credentials);
+    login_queued = true;
+    login_callback = std::move(callback);
+    return true;
+}
+
+bool EchoClient::resume(const UserCredentials& credentials, const ResumeTicket& ticket, LoginCallback callback) {
+    if (state == State::CLOSED || login_queued) {
+        return false;
+    }
+
+    ResumeRequest request = {{RESUME_REQUEST_BYTE_SIZE, RESUME_REQUEST_TYPE, 0}, ticket};
+    size_t offset = output.size();
+    output.resize(offset + RESUME_REQUEST_BYTE_SIZE);
+    serialize_resume_request(request, output.data() + offset);
+
+    key = derive_echo_key(credentials);
+    login_queued = true;
+    resuming = true;
+    login_callback = std::move(callback);
+    return true;
+}
+
+// The payload is encrypted directly into the queue. Every connection would
+// need its own KeystreamCache, which is too large to give each one in a
+// pool, so the keystream is generated afresh.
+bool EchoClient::echo(std::string_view message, EchoCallback callback) {
+    if (state == State::CLOSED || !login_queued || message.size() > MAX_ECHO_MESSAGE_SIZE ||
+        in_flight_count == ECHO_CLIENT_MAX_IN_FLIGHT) {
+        return false;
+    }
+
+    while (callbacks[next_sequence]) {
+        ++next_sequence;
+    }
+    uint8_t sequence = next_sequence++;
+
+    std::vector<uint8_t>& queue = logged_in || resuming ? output : held;
+    uint16_t message_size = static_cast<uint16_t>(message.size());
+    uint16_t frame_size = HEADER_BYTE_SIZE + SIZE_BYTE_SIZE + message_size;
+    size_t offset = queue.size();
+    queue.resize(offset + frame_size);
+    uint8_t* frame = queue.data() + offset;
+    uint8_t* payload = frame + HEADER_BYTE_SIZE + SIZE_BYTE_SIZE;
+    apply_echo_cipher(echo_cipher_seed(key, sequence), reinterpret_cast<const uint8_t*>(message.data()), payload,
+                      message_size);
+
+    EchoRequestView request = {{frame_size, ECHO_REQUEST_TYPE, sequence}, message_size,
+                               std::string_view(reinterpret_cast<const char*>(payload), message_size)};
+    serialize_echo_request(request, frame);
+
+    callbacks[sequence] = std::move(callback);
+    ++in_flight_count;
+    return true;
+}
+
+std::future<EchoReply> EchoClient::echo(std::string_view message) {
+    auto promise = std::make_shared<std::promise<EchoReply>>();
+    std::future<EchoReply> future = promise->get_future();
+    if (!echo(message, promise_callback(promise))) {
+        promise->set_value({EchoStatus::REJECTED, std::string()});
+    }
+    return future;
+}
+
+bool EchoClient::wants_write() const {
+    return state == State::CONNECTING || (state == State::CONNECTED && output_offset < output.size());
+}
+
+// Responses are dispatched before an end of stream is acted on, so the
+// ones that made it in before the server closed still complete.
+void EchoClient::handle_events(uint32_t events) {
+    if (state == State::CONNECTING) {
+        if (!(events & (POLLOUT | POLLERR | POLLHUP))) {
+            return;
+        }
+        if (!finish_connect()) {
+            fail(EchoStatus::CONNECT_FAILED);
+            return;
+        }
+    }
+    if (state != State::CONNECTED) {
+        return;
+    }
+
+    if (events & (POLLIN | POLLERR | POLLHUP)) {
+        bool closed = false;
+        if (!receive_responses(closed)) {
+            fail(EchoStatus::CLOSED);
+            return;
+        }
+        if (!dispatch_responses()) {
+            return;
+        }
+        if (closed) {
+            fail(login_queued && !logged_in ? EchoStatus::LOGIN_FAILED : EchoStatus::CLOSED);
+            return;
+        }
+    }
+    flush();
+}
+
+void EchoClient::flush() {
+    if (state == State::CONNECTED && !flush_output()) {
+        fail(EchoStatus::CLOSED);
+    }
+}
+
+bool EchoClient::poll(int timeout_ms) {
+    if (state == State::CLOSED) {
+        return false;
+    }
+
+    struct pollfd pfd = {socket_fd, static_cast<short>(POLLIN | (wants_write() ? POLLOUT : 0)), 0};
+    int ready = ::poll(&pfd, 1, timeout_ms);
+    if (ready == -1 && errno != EINTR) {
+        fail(EchoStatus::CLOSED);
+        return false;
+    }
+    if (ready > 0) {
+        handle_events(pfd.revents);
+    }
+    return state != State::CLOSED;
+}
+
+void EchoClient::close() {
+    fail(EchoStatus::CLOSED);
+}
+
+// Everything is reset before any callback runs, so callbacks are free to
+// reconnect or to issue calls that are then simply refused.
+void EchoClient::fail(EchoStatus status) {
+    if (state == State::CLOSED) {
+        return;
+    }
+
+    ::close(socket_fd);
+    socket_fd = -1;
+    state = State::CLOSED;
+    ++generation;
+    // The server closes the connection on a ticket it does not accept.
+    if (resuming && status == EchoStatus::LOGIN_FAILED) {
+        ticket_valid = false;
+    }
+    login_queued = false;
+    logged_in = false;
+    resuming = false;
+    output.clear();
+    output_offset = 0;
+    held.clear();
+    input_bytes = 0;
+    in_flight_count = 0;
+
+    LoginCallback login_done = std::move(login_callback);
+    login_callback = nullptr;
+    std::vector<EchoCallback> pending = std::move(callbacks);
+    callbacks.clear();
+
+    if (login_done) {
+        login_done(status);
+    }
+    for (EchoCallback& callback : pending) {
+        if (callback) {
+            callback(status, std::string_view());
+        }
+    }
+}
+
+bool EchoClient::finish_connect() {
+    int error = 0;
+    socklen_t length = sizeof error;
+    if (getsockopt(socket_fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1) {
+        return false;
+    }
+    if (error != 0) {
+        errno = error;
+        return false;
+    }
+    state = State::CONNECTED;
+    return true;
+}
+
+bool EchoClient::receive_responses(bool& closed) {
+    while (true) {
+        if (input.size() - input_bytes < RECEIVE_CHUNK_SIZE) {
+            input.resize(input_bytes + RECEIVE_CHUNK_SIZE);
+        }
+        ssize_t count = recv(socket_fd, input.data() + input_bytes, input.size() - input_bytes, 0);
+        if (count > 0) {
+            input_bytes += count;
+            continue;
+        }
+        if (count == 0) {
+            closed = true;
+            return true;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return true;
+        }
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+}
+
+// Each echo response is matched to its call by sequence number. Returns
+// false once the connection has been closed, by a bad frame or by a
+// callback.
+bool EchoClient::dispatch_responses() {
+    uint32_t current = generation;
+    size_t offset = 0;
+    while (input_bytes - offset >= HEADER_BYTE_SIZE) {
+        const uint8_t* frame = input.data() + offset;
+        Header header;
+        deserialize_header(header, frame);
+        if (header.message_size < HEADER_BYTE_SIZE + SIZE_BYTE_SIZE) {
+            fail(EchoStatus::PROTOCOL_ERROR);
+            return false;
+        }
+        if (input_bytes - offset < header.message_size) {
+            break;
+        }
+        offset += header.message_size;
+
+        if ((header.message_type == LOGIN_RESPONSE_TYPE && login_queued && !logged_in && !resuming) ||
+            (header.message_type == RESUME_RESPONSE_TYPE && resuming)) {
+            if (!finish_login(header, frame)) {
+                return false;
+            }
+        } else {
+            EchoResponseView response;
+            deserialize_echo_response(response, frame);
+            EchoCallback& slot = callbacks[header.message_sequence];
+            if (header.message_type != ECHO_RESPONSE_TYPE || !slot ||
+                response.message_size + HEADER_BYTE_SIZE + SIZE_BYTE_SIZE != header.message_size) {
+                fail(EchoStatus::PROTOCOL_ERROR);
+                return false;
+            }
+            EchoCallback echo_done = std::move(slot);
+            slot = nullptr;
+            --in_flight_count;
+            echo_done(EchoStatus::OK, response.plain_message);
+        }
+
+        if (generation != current) {
+            return false;
+        }
+    }
+
+    input_bytes -= offset;
+    memmove(input.data(), input.data() + offset, input_bytes);
+    return true;
+}
+
+// Keeps the ticket if the response carries one. Returns false once the
+// connection has been closed.
+bool EchoClient::finish_login(const Header& header, const uint8_t* frame) {
+    LoginResponse response;
+    const uint8_t* ticket = deserialize_login_response(response, frame);
+    if (response.status_code != LOGIN_STATUS_OK) {
+        fail(response.status_code == LOGIN_STATUS_BUSY ? EchoStatus::LOGIN_BUSY : EchoStatus::LOGIN_FAILED);
+        return false;
+    }
+    if (header.message_size == LOGIN_RESPONSE_TICKET_BYTE_SIZE) {
+        memcpy(resume_ticket.bytes, ticket, RESUME_TICKET_BYTE_SIZE);
+        ticket_valid = true;
+    }
+
+    logged_in = true;
+    resuming = false;
+    output.insert(output.end(), held.begin(), held.end());
+    held.clear();
+    LoginCallback login_done = std::move(login_callback);
+    login_callback = nullptr;
+    if (login_done) {
+        login_done(EchoStatus::OK);
+    }
+    return true;
+}
+
+bool EchoClient::flush_output() {
+    while (output_offset < output.size()) {
+        ssize_t count = send(socket_fd, output.data() + output_offset, output.size() - output_offset, MSG_NOSIGNAL);
+        if (count == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        output_offset += count;
+    }
+    output.clear();
+    output_offset = 0;
+    return true;
+}
+
+bool EchoClientPool::connect(const struct addrinfo* address, size_t count, const UserCredentials& credentials,
+                             LoginCallback callback) {
+    close();
+    clients.clear();
+
+    struct LoginProgress {
+        size_t remaining;
+        EchoStatus result;
+        LoginCallback callback;
+    };
+    auto progress = std::make_shared<LoginProgress>(LoginProgress{0, EchoStatus::CONNECT_FAILED, std::move(callback)});
+
+    for (size_t i = 0; i < count; ++i) {
+        auto client = std::make_unique<EchoClient>();
+        if (!client->connect(address)) {
+            continue;
+        }
+        client->login(credentials, [progress](EchoStatus status) {
+            if (status == EchoStatus::OK || progress->result != EchoStatus::OK) {
+                progress->result = status;
+            }
+            if (--progress->remaining == 0 && progress->callback) {
+                progress->callback(progress->result);
+            }
+        });
+        ++progress->remaining;
+        clients.push_back(std::move(client));
+    }
+    return !clients.empty();
+}
+
+bool EchoClientPool::echo(std::string_view message, EchoCallback callback) {
+    EchoClient* client = pick();
+    return client != nullptr && client->echo(message, std::move(callback));
+}
+
+std::future<EchoReply> EchoClientPool::echo(std::string_view message) {
+    auto promise = std::make_shared<std::promise<EchoReply>>();
+    std::future<EchoReply> future = promise->get_future();
+    if (!echo(message, promise_callback(promise))) {
+        promise->set_value({EchoStatus::REJECTED, std::string()});
+    }
+    return future;
+}
+
+// Logged-in connections come first, then the fewest echoes in flight;
+// connections still logging in hold their echoes back until they are in.
+// The scan starts one further along each time, so ties rotate.
+EchoClient* EchoClientPool::pick() {
+    EchoClient* best = nullptr;
+    for (size_t i = 0; i < clients.size(); ++i) {
+        EchoClient* client = clients[(next_client + i) % clients.size()].get();
+        if (!client->is_open() || client->in_flight() == ECHO_CLIENT_MAX_IN_FLIGHT) {
+            continue;
+        }
+        if (best == nullptr || (client->is_logged_in() && !best->is_logged_in()) ||
+            (client->is_logged_in() == best->is_logged_in() && client->in_flight() < best->in_flight())) {
+            best = client;
+        }
+    }
+    ++next_client;
+    return best;
+}
+
+bool EchoClientPool::poll(int timeout_ms) {
+    poll_fds.clear();
+    polled.clear();
+    for (const std::unique_ptr<EchoClient>& client : clients) {
+        if (client->is_open()) {
+            poll_fds.push_back({client->fd(), static_cast<short>(POLLIN | (client->wants_write() ? POLLOUT : 0)), 0});
+            polled.push_back(client.get());
+        }
+    }
+    if (poll_fds.empty()) {
+        return false;
+    }
+
+    int ready = ::poll(poll_fds.data(), poll_fds.size(), timeout_ms);
+    if (ready == -1 && errno != EINTR) {
+        close();
+        return false;
+    }
+    for (size_t i = 0; i < poll_fds.size() && ready > 0; ++i) {
+        if (poll_fds[i].revents != 0) {
+            polled[i]->handle_events(poll_fds[i].revents);
+        }
+    }
+
+    for (const std::unique_ptr<EchoClient>& client : clients) {
+        if (client->is_open()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void EchoClientPool::close() {
+    for (const std::unique_ptr<EchoClient>& client : clients) {
+        client->close();
+    }
+}
@@ -0,0 +1,186 @@
+#ifndef ECHO_CLIENT_HPP
+#define ECHO_CLIENT_HPP
+
+#include "common.hpp"
+#include <functional>
+#include <future>
+#include <memory>
+#include <poll.h>
+
+// How a login or echo call ended. Anything other than OK and REJECTED means
+// the connection is closed and every call still pending on it ended too.
+enum class EchoStatus : uint8_t {
+    OK,
+    REJECTED,
+    CONNECT_FAILED,
+    LOGIN_FAILED,
+    LOGIN_BUSY,
+    CLOSED,
+    PROTOCOL_ERROR
+};
+
+const char* echo_status_name(EchoStatus status);
+
+struct EchoReply {
+    EchoStatus status;
+    std::string message;
+};
+
+// The message view points into the client's receive buffer and is only
+// valid during the callback.
+using EchoCallback = std::function<void(EchoStatus status, std::string_view message)>;
+using LoginCallback = std::function<void(EchoStatus status)>;
+
+// Sequence numbers are a byte, which caps the echoes in flight on one
+// connection.
+const size_t ECHO_CLIENT_MAX_IN_FLIGHT = 256;
+const size_t MAX_ECHO_MESSAGE_SIZE = UINT16_MAX - HEADER_BYTE_SIZE - SIZE_BYTE_SIZE;
+
+// One connection to the echo server that never blocks and never waits on
+// its own. The owner registers fd() with its event loop, waits for
+// writability too while wants_write() says so, and passes whatever fired
+// to handle_events(); poll() does all of that for callers without a loop.
+//
+// Echoes are pipelined: each one is framed and encrypted straight into the
+// output buffer under a free sequence number, and its response is matched
+// back to the call by that sequence. Echoes issued before the login has
+// been accepted are held back and go out once it is. Callbacks and futures
+// complete from handle_events(), so a thread blocked on a future needs
+// another thread driving the connection. Not thread-safe, and a client must
+// not be destroyed from one of its own callbacks.
+class EchoClient {
+public:
+    EchoClient() = default;
+    ~EchoClient();
+    EchoClient(const EchoClient&) = delete;
+    EchoClient& operator=(const EchoClient&) = delete;
+
+    // Starts connecting. Returns false, with errno set, if that failed
+    // right away.
+    bool connect(const struct addrinfo* address);
+
+    // Queues the login; it can be called before the connect has finished.
+    // Returns false without calling back if the connection is closed or
+    // already has a login. The server closes the connection on bad
+    // credentials, which ends the call with LOGIN_FAILED. A server too busy
+    // to check them answers LOGIN_BUSY, and the connection is closed too so
+    // that the owner can back off and reconnect.
+    bool login(const UserCredentials& credentials, LoginCallback callback);
+
+    // Queues a resume with a ticket from an earlier login in place of a
+    // login; it can also be called before the connect has finished.
+    // Echoes are sent right behind it instead of waiting for the answer, so
+    // the first of them costs no extra round trip. The credentials only
+    // derive the echo key locally and are not sent. A server that refuses
+    // the ticket closes the connection, which ends the call and every echo
+    // already queued with LOGIN_FAILED; log in again then.
+    bool resume(const UserCredentials& credentials, const ResumeTicket& ticket, LoginCallback callback);
+
+    // Queues an echo of message. Returns false without calling back if the
+    // connection is closed, no login was queued, the message is larger than
+    // MAX_ECHO_MESSAGE_SIZE or ECHO_CLIENT_MAX_IN_FLIGHT echoes are already
+    // pending. The future overload reports those cases as REJECTED.
+    bool echo(std::string_view message, EchoCallback callback);
+    std::future<EchoReply> echo(std::string_view message);
+
+    int fd() const { return socket_fd; }
+    bool is_open() const { return state != State::CLOSED; }
+    bool is_logged_in() const { return logged_in; }
+    size_t in_flight() const { return in_flight_count; }
+
+    // The latest ticket the server handed out on this client, kept across
+    // closes so that the next connection can resume with it.
+    bool has_ticket() const { return ticket_valid; }
+    const ResumeTicket& ticket() const { return resume_ticket; }
+    bool wants_write() const;
+
+    // events are poll or epoll flags, which share their values. Finishes
+    // the connect, dispatches every complete response and sends whatever
+    // is queued.
+    void handle_events(uint32_t events);
+
+    // Calls only queue their frames, so that a burst of them goes out in
+    // one send. Owners that do not want to wait for the next event send
+    // them right away with this.
+    void flush();
+
+    // Waits up to timeout_ms for the socket and handles what fired.
+    // Returns false once the connection is closed.
+    bool poll(int timeout_ms);
+
+    // Ends every pending call with CLOSED.
+    void close();
+
+private:
+    enum class State : uint8_t {
+        CLOSED,
+        CONNECTING,
+        CONNECTED
+    };
+
+    void fail(EchoStatus status);
+    bool finish_connect();
+    bool receive_responses(bool& closed);
+    bool dispatch_responses();
+    bool finish_login(const Header& header, const uint8_t* frame);
+    bool flush_output();
+
+    int socket_fd = -1;
+    State state = State::CLOSED;
+    // Bumped on every close, so dispatch can tell that a callback closed
+    // the connection under it.
+    uint32_t generation = 0;
+    bool login_queued = false;
+    bool logged_in = false;
+    bool resuming = false;
+    bool ticket_valid = false;
+    ResumeTicket resume_ticket;
+    EchoKey key = {0, 0};
+    LoginCallback login_callback;
+
+    // Indexed by sequence number; an empty slot is free.
+    std::vector<EchoCallback> callbacks;
+    size_t in_flight_count = 0;
+    uint8_t next_sequence = 0;
+
+    std::vector<uint8_t> output;
+    size_t output_offset = 0;
+    std::vector<uint8_t> held;
+    std::vector<uint8_t> input;
+    size_t input_bytes = 0;
+};
+
+// A fixed set of connections to one server. Each echo goes to the
+// logged-in connection with the fewest echoes in flight, so a connection
+// that falls behind stops getting new work. Connections that close stay
+// closed; the pool carries on with the rest.
+class EchoClientPool {
+public:
+    // Starts count connections and logs each of them in. callback runs
+    // once every login has ended: with OK if at least one connection is
+    // usable, otherwise with the last failure. Returns false, with errno
+    // set, if no connection could even be started.
+    bool connect(const struct addrinfo* address, size_t count, const UserCredentials& credentials, LoginCallback callback);
+
+    bool echo(std::string_view message, EchoCallback callback);
+    std::future<EchoReply> echo(std::string_view message);
+
+    size_t size() const { return clients.size(); }
+    EchoClient& client(size_t index) { return *clients[index]; }
+
+    // Like EchoClient::poll, over every open connection. Returns false once
+    // they are all closed.
+    bool poll(int timeout_ms);
+
+    void close();
+
+private:
+    EchoClient* pick();
+
+    std::vector<std::unique_ptr<EchoClient>> clients;
+    std::vector<struct pollfd> poll_fds;
+    std::vector<EchoClient*> polled;
+    size_t next_client = 0;
+};
+
+#endif
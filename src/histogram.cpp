@@ -0,0 +1,75 @@
+#include "histogram.hpp"
+#include <algorithm>
+#include <cmath>
+
+static size_t bucket_index(uint64_t value) {
+    if (value < (uint64_t(1) << HISTOGRAM_PRECISION_BITS)) {
+        return static_cast<size_t>(value);
+    }
+    unsigned magnitude = 63 - __builtin_clzll(value);
+    if (magnitude > HISTOGRAM_MAX_MAGNITUDE) {
+        return HISTOGRAM_BUCKET_COUNT - 1;
+    }
+    unsigned shift = magnitude - (HISTOGRAM_PRECISION_BITS - 1);
+    return shift * HISTOGRAM_SUB_BUCKETS + static_cast<size_t>(value >> shift);
+}
+
+static uint64_t bucket_upper_bound(size_t index) {
+    if (index < (size_t(1) << HISTOGRAM_PRECISION_BITS)) {
+        return index;
+    }
+    unsigned shift = static_cast<unsigned>(index / HISTOGRAM_SUB_BUCKETS) - 1;
+    uint64_t mantissa = index % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+Histogram::Histogram() : counts(HISTOGRAM_BUCKET_COUNT, 0) {}
+
+void Histogram::record(uint64_t value) {
+    ++counts[bucket_index(value)];
+    ++total_count;
+    min_value = std::min(min_value, value);
+    max_value = std::max(max_value, value);
+    sum += value;
+}
+
+void Histogram::merge(const Histogram& other) {
+    for (size_t i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i) {
+        counts[i] += other.counts[i];
+    }
+    total_count += other.total_count;
+    min_value = std::min(min_value, other.min_value);
+    max_value = std::max(max_value, other.max_value);
+    sum += other.sum;
+}
+
+void Histogram::reset() {
+    std::fill(counts.begin(), counts.end(), 0);
+    total_count = 0;
+    min_value = UINT64_MAX;
+    max_value = 0;
+    sum = 0;
+}
+
+double Histogram::mean() const {
+    return total_count == 0 ? 0.0 : static_cast<double>(sum / total_count);
+}
+
+// The bucket bound is clamped to the largest value seen, so the 100th
+// percentile is the exact maximum.
+uint64_t Histogram::percentile(double percent) const {
+    if (total_count == 0) {
+        return 0;
+    }
+    uint64_t target = static_cast<uint64_t>(std::ceil(percent / 100.0 * total_count));
+    target = std::max<uint64_t>(target, 1);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKET_COUNT; ++i) {
+        seen += counts[i];
+        if (seen >= target) {
+            return std::min(bucket_upper_bound(i), max_value);
+        }
+    }
+    return max_value;
+}
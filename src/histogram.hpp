@@ -0,0 +1,43 @@
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Log-linear histogram in the style of HdrHistogram: values below
+// 2^HISTOGRAM_PRECISION_BITS are counted exactly, and every power of two
+// above that is split into 2^(HISTOGRAM_PRECISION_BITS - 1) linear
+// sub-buckets, so any recorded value is reported within 1/64 of itself.
+// Values past 2^HISTOGRAM_MAX_MAGNITUDE land in the last bucket.
+const unsigned HISTOGRAM_PRECISION_BITS = 7;
+const unsigned HISTOGRAM_MAX_MAGNITUDE = 40;
+const size_t HISTOGRAM_SUB_BUCKETS = size_t(1) << (HISTOGRAM_PRECISION_BITS - 1);
+const size_t HISTOGRAM_BUCKET_COUNT =
+    (HISTOGRAM_MAX_MAGNITUDE - HISTOGRAM_PRECISION_BITS + 3) * HISTOGRAM_SUB_BUCKETS;
+
+class Histogram {
+public:
+    Histogram();
+
+    void record(uint64_t value);
+    void merge(const Histogram& other);
+    void reset();
+
+    uint64_t count() const { return total_count; }
+    uint64_t min() const { return total_count == 0 ? 0 : min_value; }
+    uint64_t max() const { return max_value; }
+    double mean() const;
+
+    // Upper bound of the bucket holding the given percentile (0-100).
+    uint64_t percentile(double percent) const;
+
+private:
+    std::vector<uint64_t> counts;
+    uint64_t total_count = 0;
+    uint64_t min_value = UINT64_MAX;
+    uint64_t max_value = 0;
+    long double sum = 0;
+};
+
+#endif
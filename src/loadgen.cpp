@@ -0,0 +1,649 @@
+#include "common.hpp"
+#include "histogram.hpp"
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <algorithm>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <functional>
+#include <random>
+#include <thread>
+
+const char DEFAULT_SERVER_IP[] = "127.0.0.1";
+const int MAX_EVENTS = 256;
+const uint64_t NANOSECONDS_PER_SECOND = 1000000000;
+const uint64_t DRAIN_TIMEOUT_NS = 2 * NANOSECONDS_PER_SECOND;
+const size_t MAX_PAYLOAD_SIZE = UINT16_MAX - HEADER_BYTE_SIZE - SIZE_BYTE_SIZE;
+const size_t RECEIVE_CHUNK_SIZE = 64 * 1024;
+
+struct LoadgenConfig {
+    const char* server_ip = DEFAULT_SERVER_IP;
+    const char* port = DEFAULT_PORT;
+    int connections = 1;
+    int threads = 1;
+    size_t min_size = 64;
+    size_t max_size = 64;
+    int pipeline = 1;
+    // Messages per second across all connections; 0 runs closed-loop.
+    double rate = 0;
+    double duration = 10;
+    double warmup = 0;
+    std::string username = "admin";
+    std::string password = "12345";
+};
+
+enum class ConnectionState : uint8_t {
+    CONNECTING,
+    LOGGING_IN,
+    RUNNING,
+    CLOSED
+};
+
+// An echo waiting for its response. The payload is regenerated from the
+// pattern for verification instead of being kept around.
+struct PendingEcho {
+    uint64_t start;
+    uint32_t pattern;
+    uint16_t size;
+    uint8_t sequence;
+};
+
+struct LoadConnection {
+    int fd = -1;
+    ConnectionState state = ConnectionState::CONNECTING;
+    uint8_t next_sequence = 0;
+    std::deque<PendingEcho> pending;
+    std::vector<uint8_t> output;
+    size_t output_offset = 0;
+    std::vector<uint8_t> input;
+    size_t input_bytes = 0;
+};
+
+struct WorkerStats {
+    Histogram latency;
+    uint64_t sent = 0;
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+    uint64_t logged_in = 0;
+    uint64_t never_logged_in = 0;
+    uint64_t failed_connections = 0;
+    uint64_t failed_logins = 0;
+    uint64_t verify_errors = 0;
+    uint64_t unanswered = 0;
+};
+
+// Per-thread run state. Latency is recorded for responses that arrive
+// between measure_from and deadline; nothing new is sent after deadline.
+struct Worker {
+    const LoadgenConfig* config;
+    int epoll_fd = -1;
+    std::vector<LoadConnection> connections;
+    UserCredentials credentials;
+    EchoKey key;
+    KeystreamCache keystream_cache;
+    std::mt19937 random;
+    uint64_t measure_from = 0;
+    uint64_t deadline = 0;
+    WorkerStats stats;
+};
+
+bool parse_arguments(int argc, char* argv[], LoadgenConfig& config);
+bool parse_size_range(const std::string& value, size_t& min_size, size_t& max_size);
+uint64_t now_ns();
+void run_worker(const LoadgenConfig& config, const addrinfo* address, int connection_count, double rate,
+                uint64_t start, Worker& worker);
+bool open_connection(Worker& worker, const addrinfo* address, uint32_t index);
+void handle_connected(Worker& worker, LoadConnection& connection);
+void handle_readable(Worker& worker, LoadConnection& connection);
+bool process_responses(Worker& worker, LoadConnection& connection);
+void queue_login(Worker& worker, LoadConnection& connection);
+void queue_echo(Worker& worker, LoadConnection& connection, uint64_t start);
+bool flush_output(LoadConnection& connection);
+void close_connection(Worker& worker, LoadConnection& connection);
+void fill_payload(uint8_t* payload, size_t size, uint32_t pattern);
+bool verify_payload(const uint8_t* payload, size_t size, uint32_t pattern);
+void print_report(const LoadgenConfig& config, const WorkerStats& stats);
+
+int main(int argc, char* argv[]) {
+    LoadgenConfig config;
+    if (!parse_arguments(argc, argv, config)) {
+        std::cerr << "Usage: " << argv[0] << " [server_ip] [port] [--connections N] [--threads N]"
+                  << " [--size BYTES|MIN-MAX] [--pipeline N] [--rate MSGS_PER_SEC]"
+                  << " [--duration SECONDS] [--warmup SECONDS] [--username NAME] [--password PASS]\n";
+        return 1;
+    }
+
+    struct addrinfo hints, *address;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int status = getaddrinfo(config.server_ip, config.port, &hints, &address);
+    if (status != 0) {
+        std::cerr << "getaddrinfo error: " << gai_strerror(status) << "\n";
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // Connections and the target rate are split evenly across threads; the
+    // first threads take the remainder.
+    int threads = std::min(config.threads, config.connections);
+    std::vector<Worker> workers(threads);
+    std::vector<std::thread> runners;
+    uint64_t start = now_ns();
+    for (int i = 0; i < threads; ++i) {
+        int count = config.connections / threads + (i < config.connections % threads ? 1 : 0);
+        double rate = config.rate * count / config.connections;
+        runners.emplace_back(run_worker, std::cref(config), address, count, rate, start, std::ref(workers[i]));
+    }
+    for (std::thread& runner : runners) {
+        runner.join();
+    }
+    freeaddrinfo(address);
+
+    WorkerStats total;
+    for (const Worker& worker : workers) {
+        total.latency.merge(worker.stats.latency);
+        total.sent += worker.stats.sent;
+        total.messages += worker.stats.messages;
+        total.bytes += worker.stats.bytes;
+        total.logged_in += worker.stats.logged_in;
+        total.never_logged_in += worker.stats.never_logged_in;
+        total.failed_connections += worker.stats.failed_connections;
+        total.failed_logins += worker.stats.failed_logins;
+        total.verify_errors += worker.stats.verify_errors;
+        total.unanswered += worker.stats.unanswered;
+    }
+    print_report(config, total);
+
+    bool failed = total.verify_errors > 0 || total.failed_connections > 0 || total.failed_logins > 0;
+    return failed ? 1 : 0;
+}
+
+bool parse_arguments(int argc, char* argv[], LoadgenConfig& config) {
+    int positional = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+        size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) == 0 && eq != std::string::npos) {
+            value = arg.substr(eq + 1);
+            arg = arg.substr(0, eq);
+        } else if (arg.rfind("--", 0) == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << "\n";
+                return false;
+            }
+            value = argv[++i];
+        }
+
+        if (arg == "--connections") {
+            config.connections = atoi(value.c_str());
+            if (config.connections < 1) {
+                std::cerr << "Invalid connection count: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--threads") {
+            config.threads = atoi(value.c_str());
+            if (config.threads < 1) {
+                std::cerr << "Invalid thread count: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--size") {
+            if (!parse_size_range(value, config.min_size, config.max_size)) {
+                std::cerr << "Invalid payload size: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--pipeline") {
+            config.pipeline = atoi(value.c_str());
+            if (config.pipeline < 1) {
+                std::cerr << "Invalid pipeline depth: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--rate") {
+            config.rate = atof(value.c_str());
+            if (config.rate < 0) {
+                std::cerr << "Invalid rate: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--duration") {
+            config.duration = atof(value.c_str());
+            if (config.duration <= 0) {
+                std::cerr << "Invalid duration: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--warmup") {
+            config.warmup = atof(value.c_str());
+            if (config.warmup < 0) {
+                std::cerr << "Invalid warmup: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--username") {
+            if (value.size() >= USER_BYTE_SIZE) {
+                std::cerr << "Username too long: " << value << "\n";
+                return false;
+            }
+            config.username = value;
+        } else if (arg == "--password") {
+            if (value.size() >= PASS_BYTE_SIZE) {
+                std::cerr << "Password too long\n";
+                return false;
+            }
+            config.password = value;
+        } else if (arg.rfind("--", 0) == 0 || positional == 2) {
+            std::cerr << "Unknown argument: " << arg << "\n";
+            return false;
+        } else if (positional++ == 0) {
+            config.server_ip = argv[i];
+        } else {
+            config.port = argv[i];
+        }
+    }
+    return true;
+}
+
+// Accepts either a single size or an inclusive MIN-MAX range.
+bool parse_size_range(const std::string& value, size_t& min_size, size_t& max_size) {
+    size_t dash = value.find('-');
+    char* end;
+    unsigned long low = strtoul(value.c_str(), &end, 10);
+    unsigned long high = low;
+    if (dash != std::string::npos) {
+        high = strtoul(value.c_str() + dash + 1, &end, 10);
+    }
+    if (*end != '\0' || low == 0 || high < low || high > MAX_PAYLOAD_SIZE) {
+        return false;
+    }
+    min_size = low;
+    max_size = high;
+    return true;
+}
+
+uint64_t now_ns() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * NANOSECONDS_PER_SECOND + now.tv_nsec;
+}
+
+// Closed-loop keeps config.pipeline echoes in flight per connection. Open
+// loop sends at fixed intervals regardless of outstanding responses and
+// measures latency from each message's scheduled send time, so a stalled
+// server shows up in the percentiles instead of silently lowering the rate.
+void run_worker(const LoadgenConfig& config, const addrinfo* address, int connection_count, double rate,
+                uint64_t start, Worker& worker) {
+    worker.config = &config;
+    worker.measure_from = start + static_cast<uint64_t>(config.warmup * NANOSECONDS_PER_SECOND);
+    worker.deadline = worker.measure_from + static_cast<uint64_t>(config.duration * NANOSECONDS_PER_SECOND);
+    worker.random.seed(static_cast<uint32_t>(start) ^ static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())));
+
+    memset(&worker.credentials, 0, sizeof worker.credentials);
+    memcpy(worker.credentials.username, config.username.data(), config.username.size());
+    memcpy(worker.credentials.password, config.password.data(), config.password.size());
+    worker.key = derive_echo_key(worker.credentials);
+
+    worker.epoll_fd = epoll_create1(0);
+    if (worker.epoll_fd == -1) {
+        std::cerr << "Error creating epoll instance: " << strerror(errno) << "\n";
+        worker.stats.failed_connections += connection_count;
+        return;
+    }
+
+    worker.connections.resize(connection_count);
+    int open_connections = 0;
+    for (int i = 0; i < connection_count; ++i) {
+        if (open_connection(worker, address, i)) {
+            ++open_connections;
+        } else {
+            ++worker.stats.failed_connections;
+        }
+    }
+
+    uint64_t interval = rate > 0 ? static_cast<uint64_t>(NANOSECONDS_PER_SECOND / rate) : 0;
+    uint64_t next_send = start;
+    size_t next_connection = 0;
+    std::vector<epoll_event> events(MAX_EVENTS);
+
+    while (open_connections > 0) {
+        uint64_t now = now_ns();
+        if (now >= worker.deadline + DRAIN_TIMEOUT_NS) {
+            break;
+        }
+        if (now >= worker.deadline) {
+            bool drained = true;
+            for (const LoadConnection& connection : worker.connections) {
+                if (connection.state == ConnectionState::RUNNING && !connection.pending.empty()) {
+                    drained = false;
+                    break;
+                }
+            }
+            if (drained) {
+                break;
+            }
+        }
+
+        int timeout = 100;
+        if (interval > 0 && next_send < worker.deadline) {
+            timeout = next_send > now ? static_cast<int>((next_send - now + 999999) / 1000000) : 0;
+        }
+        int event_count = epoll_wait(worker.epoll_fd, events.data(), MAX_EVENTS, timeout);
+        if (event_count == -1 && errno != EINTR) {
+            std::cerr << "Error during epoll_wait: " << strerror(errno) << "\n";
+            break;
+        }
+
+        for (int i = 0; i < event_count; ++i) {
+            LoadConnection& connection = worker.connections[events[i].data.u32];
+            if (connection.state == ConnectionState::CLOSED) {
+                continue;
+            }
+            if (connection.state == ConnectionState::CONNECTING) {
+                handle_connected(worker, connection);
+            } else {
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    handle_readable(worker, connection);
+                }
+                if (connection.state != ConnectionState::CLOSED && (events[i].events & EPOLLOUT)) {
+                    if (!flush_output(connection)) {
+                        close_connection(worker, connection);
+                    }
+                }
+            }
+            if (connection.state == ConnectionState::CLOSED) {
+                --open_connections;
+            }
+        }
+
+        // Everything that came due while waiting goes out now, spread
+        // round-robin over the logged-in connections.
+        now = now_ns();
+        while (interval > 0 && next_send <= now && next_send < worker.deadline) {
+            LoadConnection* target = nullptr;
+            for (size_t tries = 0; tries < worker.connections.size() && target == nullptr; ++tries) {
+                LoadConnection& candidate = worker.connections[next_connection];
+                next_connection = (next_connection + 1) % worker.connections.size();
+                if (candidate.state == ConnectionState::RUNNING) {
+                    target = &candidate;
+                }
+            }
+            if (target == nullptr) {
+                next_send = now + interval;
+                break;
+            }
+            queue_echo(worker, *target, next_send);
+            if (!flush_output(*target)) {
+                close_connection(worker, *target);
+                --open_connections;
+            }
+            next_send += interval;
+        }
+    }
+
+    for (LoadConnection& connection : worker.connections) {
+        if (connection.state == ConnectionState::RUNNING) {
+            worker.stats.unanswered += connection.pending.size();
+        } else if (connection.state != ConnectionState::CLOSED) {
+            ++worker.stats.never_logged_in;
+        }
+        if (connection.state != ConnectionState::CLOSED) {
+            close_connection(worker, connection);
+        }
+    }
+    close(worker.epoll_fd);
+}
+
+bool open_connection(Worker& worker, const addrinfo* address, uint32_t index) {
+    LoadConnection& connection = worker.connections[index];
+    connection.state = ConnectionState::CLOSED;
+
+    int fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+    if (fd == -1) {
+        std::cerr << "Error creating socket: " << strerror(errno) << "\n";
+        return false;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+    if (connect(fd, address->ai_addr, address->ai_addrlen) == -1 && errno != EINPROGRESS) {
+        std::cerr << "Error connecting: " << strerror(errno) << "\n";
+        close(fd);
+        return false;
+    }
+
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.u32 = index;
+    if (epoll_ctl(worker.epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        std::cerr << "Error adding socket to epoll: " << strerror(errno) << "\n";
+        close(fd);
+        return false;
+    }
+
+    connection.fd = fd;
+    connection.state = ConnectionState::CONNECTING;
+    connection.input.resize(RECEIVE_CHUNK_SIZE);
+    return true;
+}
+
+void handle_connected(Worker& worker, LoadConnection& connection) {
+    int error = 0;
+    socklen_t length = sizeof error;
+    if (getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0) {
+        std::cerr << "Error connecting: " << strerror(error != 0 ? error : errno) << "\n";
+        ++worker.stats.failed_connections;
+        close_connection(worker, connection);
+        return;
+    }
+
+    connection.state = ConnectionState::LOGGING_IN;
+    queue_login(worker, connection);
+    if (!flush_output(connection)) {
+        ++worker.stats.failed_connections;
+        close_connection(worker, connection);
+    }
+}
+
+void handle_readable(Worker& worker, LoadConnection& connection) {
+    while (true) {
+        if (connection.input.size() - connection.input_bytes < RECEIVE_CHUNK_SIZE) {
+            connection.input.resize(connection.input_bytes + RECEIVE_CHUNK_SIZE);
+        }
+        ssize_t count = recv(connection.fd, connection.input.data() + connection.input_bytes,
+                             connection.input.size() - connection.input_bytes, 0);
+        if (count > 0) {
+            connection.input_bytes += count;
+            continue;
+        }
+        if (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count == -1) {
+            std::cerr << "Error reading from server: " << strerror(errno) << "\n";
+        } else if (connection.state == ConnectionState::LOGGING_IN) {
+            ++worker.stats.failed_logins;
+        }
+        if (connection.state == ConnectionState::RUNNING) {
+            worker.stats.unanswered += connection.pending.size();
+        }
+        close_connection(worker, connection);
+        return;
+    }
+
+    if (!process_responses(worker, connection) || !flush_output(connection)) {
+        close_connection(worker, connection);
+    }
+}
+
+// Responses come back in request order, so each one is matched against the
+// oldest pending echo.
+bool process_responses(Worker& worker, LoadConnection& connection) {
+    size_t offset = 0;
+    while (connection.input_bytes - offset >= HEADER_BYTE_SIZE) {
+        const uint8_t* frame = connection.input.data() + offset;
+        Header header;
+        deserialize_header(header, frame);
+        if (header.message_size < HEADER_BYTE_SIZE + SIZE_BYTE_SIZE) {
+            std::cerr << "Malformed frame from server\n";
+            return false;
+        }
+        if (connection.input_bytes - offset < header.message_size) {
+            break;
+        }
+        offset += header.message_size;
+
+        if (connection.state == ConnectionState::LOGGING_IN) {
+            LoginResponse response;
+            deserialize_login_response(response, frame);
+            if (header.message_type != LOGIN_RESPONSE_TYPE || response.status_code != LOGIN_STATUS_OK) {
+                ++worker.stats.failed_logins;
+                return false;
+            }
+            connection.state = ConnectionState::RUNNING;
+            ++worker.stats.logged_in;
+            if (worker.config->rate == 0) {
+                for (int i = 0; i < worker.config->pipeline; ++i) {
+                    queue_echo(worker, connection, now_ns());
+                }
+            }
+            continue;
+        }
+
+        EchoResponseView response;
+        deserialize_echo_response(response, frame);
+        if (header.message_type != ECHO_RESPONSE_TYPE || connection.pending.empty()) {
+            std::cerr << "Unexpected frame type " << static_cast<int>(header.message_type) << " from server\n";
+            return false;
+        }
+
+        PendingEcho echo = connection.pending.front();
+        connection.pending.pop_front();
+        const uint8_t* payload = reinterpret_cast<const uint8_t*>(response.plain_message.data());
+        if (header.message_sequence != echo.sequence || response.message_size != echo.size ||
+            response.message_size + HEADER_BYTE_SIZE + SIZE_BYTE_SIZE != header.message_size ||
+            !verify_payload(payload, echo.size, echo.pattern)) {
+            ++worker.stats.verify_errors;
+        }
+
+        uint64_t now = now_ns();
+        if (now >= worker.measure_from && now < worker.deadline) {
+            worker.stats.latency.record(now - echo.start);
+            ++worker.stats.messages;
+            worker.stats.bytes += echo.size;
+        }
+        if (worker.config->rate == 0 && now < worker.deadline) {
+            queue_echo(worker, connection, now);
+        }
+    }
+
+    connection.input_bytes -= offset;
+    memmove(connection.input.data(), connection.input.data() + offset, connection.input_bytes);
+    return true;
+}
+
+void queue_login(Worker& worker, LoadConnection& connection) {
+    LoginRequest request = {{LOGIN_REQUEST_BYTE_SIZE, LOGIN_REQUEST_TYPE, connection.next_sequence++}, worker.credentials};
+    size_t offset = connection.output.size();
+    connection.output.resize(offset + LOGIN_REQUEST_BYTE_SIZE);
+    serialize_login_request(request, connection.output.data() + offset);
+}
+
+// The payload is generated and encrypted directly in the output buffer.
+void queue_echo(Worker& worker, LoadConnection& connection, uint64_t start) {
+    const LoadgenConfig& config = *worker.config;
+    std::uniform_int_distribution<size_t> sizes(config.min_size, config.max_size);
+    PendingEcho echo;
+    echo.start = start;
+    echo.pattern = worker.random();
+    echo.size = static_cast<uint16_t>(sizes(worker.random));
+    echo.sequence = connection.next_sequence++;
+
+    size_t offset = connection.output.size();
+    size_t frame_size = HEADER_BYTE_SIZE + SIZE_BYTE_SIZE + echo.size;
+    connection.output.resize(offset + frame_size);
+    uint8_t* frame = connection.output.data() + offset;
+    uint8_t* payload = frame + HEADER_BYTE_SIZE + SIZE_BYTE_SIZE;
+    fill_payload(payload, echo.size, echo.pattern);
+    worker.keystream_cache.apply(echo_cipher_seed(worker.key, echo.sequence), payload, payload, echo.size);
+
+    EchoRequestView request = {{static_cast<uint16_t>(frame_size), ECHO_REQUEST_TYPE, echo.sequence}, echo.size,
+                               std::string_view(reinterpret_cast<const char*>(payload), echo.size)};
+    serialize_echo_request(request, frame);
+    connection.pending.push_back(echo);
+    if (start >= worker.measure_from && start < worker.deadline) {
+        ++worker.stats.sent;
+    }
+}
+
+// Sends as much queued output as the socket takes. Whatever is left goes
+// out on the next EPOLLOUT edge.
+bool flush_output(LoadConnection& connection) {
+    while (connection.output_offset < connection.output.size()) {
+        ssize_t count = send(connection.fd, connection.output.data() + connection.output_offset,
+                             connection.output.size() - connection.output_offset, MSG_NOSIGNAL);
+        if (count == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Error sending to server: " << strerror(errno) << "\n";
+            return false;
+        }
+        connection.output_offset += count;
+    }
+    connection.output.clear();
+    connection.output_offset = 0;
+    return true;
+}
+
+void close_connection(Worker& worker, LoadConnection& connection) {
+    epoll_ctl(worker.epoll_fd, EPOLL_CTL_DEL, connection.fd, nullptr);
+    close(connection.fd);
+    connection.fd = -1;
+    connection.state = ConnectionState::CLOSED;
+    connection.pending.clear();
+}
+
+void fill_payload(uint8_t* payload, size_t size, uint32_t pattern) {
+    for (size_t i = 0; i < size; ++i) {
+        payload[i] = static_cast<uint8_t>(pattern + i * 131);
+    }
+}
+
+bool verify_payload(const uint8_t* payload, size_t size, uint32_t pattern) {
+    for (size_t i = 0; i < size; ++i) {
+        if (payload[i] != static_cast<uint8_t>(pattern + i * 131)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void print_report(const LoadgenConfig& config, const WorkerStats& stats) {
+    double seconds = config.duration;
+    printf("connections: %llu logged in, %llu failed to connect, %llu failed to log in, %llu still pending\n",
+           static_cast<unsigned long long>(stats.logged_in),
+           static_cast<unsigned long long>(stats.failed_connections),
+           static_cast<unsigned long long>(stats.failed_logins),
+           static_cast<unsigned long long>(stats.never_logged_in));
+    printf("messages:    %llu sent, %llu echoed in %.1f s (%.0f msg/s, %.2f MB/s payload)\n",
+           static_cast<unsigned long long>(stats.sent),
+           static_cast<unsigned long long>(stats.messages), seconds,
+           stats.messages / seconds, stats.bytes / seconds / 1e6);
+    printf("errors:      %llu verification failures, %llu unanswered\n",
+           static_cast<unsigned long long>(stats.verify_errors),
+           static_cast<unsigned long long>(stats.unanswered));
+    printf("latency us:  min %.1f  mean %.1f  p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           stats.latency.min() / 1e3, stats.latency.mean() / 1e3,
+           stats.latency.percentile(50) / 1e3, stats.latency.percentile(99) / 1e3,
+           stats.latency.percentile(99.9) / 1e3, stats.latency.max() / 1e3);
+}
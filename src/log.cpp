@@ -0,0 +1,202 @@
+#include "log.hpp"
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include <strings.h>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+const std::chrono::milliseconds LOG_FLUSH_INTERVAL(10);
+
+static_assert((LOG_RING_CAPACITY & (LOG_RING_CAPACITY - 1)) == 0, "LOG_RING_CAPACITY must be a power of two");
+
+std::atomic<LogLevel> log_threshold(LogLevel::WARN);
+
+static const char* const LEVEL_NAMES[] = {"OFF", "ERROR", "WARN", "INFO", "DEBUG"};
+
+struct LogRecord {
+    uint64_t timestamp_ns;
+    LogLevel level;
+    uint16_t length;
+    char text[LOG_MESSAGE_SIZE];
+};
+
+// Single-producer single-consumer ring: the owning thread advances tail
+// after filling a record, the flusher advances head after writing it out.
+struct LogRing {
+    alignas(64) std::atomic<uint64_t> head{0};
+    alignas(64) std::atomic<uint64_t> tail{0};
+    std::atomic<uint64_t> dropped{0};
+    uint64_t dropped_reported = 0;
+    unsigned thread_index = 0;
+    LogRecord records[LOG_RING_CAPACITY];
+};
+
+// Rings are registered once and never freed, like the stats, so the flusher
+// can drain them without coordinating with thread exit.
+static std::mutex registry_mutex;
+static std::vector<LogRing*> registry;
+
+static std::mutex flusher_mutex;
+static std::condition_variable flusher_wakeup;
+static std::thread flusher;
+static bool flusher_stopping = false;
+
+static LogRing& thread_log_ring() {
+    static thread_local LogRing* ring = [] {
+        LogRing* created = new LogRing();
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        created->thread_index = registry.size();
+        registry.push_back(created);
+        return created;
+    }();
+    return *ring;
+}
+
+void set_log_level(LogLevel level) {
+    log_threshold.store(level, std::memory_order_relaxed);
+}
+
+bool parse_log_level(const std::string& name, LogLevel& level) {
+    for (size_t i = 0; i < sizeof LEVEL_NAMES / sizeof LEVEL_NAMES[0]; ++i) {
+        if (strcasecmp(name.c_str(), LEVEL_NAMES[i]) == 0) {
+            level = static_cast<LogLevel>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void log_write(LogLevel level, const char* format, ...) {
+    LogRing& ring = thread_log_ring();
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    if (tail - ring.head.load(std::memory_order_acquire) == LOG_RING_CAPACITY) {
+        ring.dropped.store(ring.dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+
+    LogRecord& record = ring.records[tail & (LOG_RING_CAPACITY - 1)];
+    timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record.timestamp_ns = static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+    record.level = level;
+
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(record.text, sizeof record.text, format, args);
+    va_end(args);
+    if (length < 0) {
+        length = 0;
+    } else if (static_cast<size_t>(length) >= sizeof record.text) {
+        length = sizeof record.text - 1;
+    }
+    record.length = length;
+
+    ring.tail.store(tail + 1, std::memory_order_release);
+}
+
+static void append_record(std::string& output, unsigned thread_index, const LogRecord& record) {
+    time_t seconds = record.timestamp_ns / 1000000000;
+    unsigned microseconds = (record.timestamp_ns % 1000000000) / 1000;
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+
+    char prefix[64];
+    size_t length = strftime(prefix, sizeof prefix, "%Y-%m-%dT%H:%M:%S", &utc);
+    snprintf(prefix + length, sizeof prefix - length, ".%06uZ %-5s [%u] ", microseconds,
+             LEVEL_NAMES[static_cast<size_t>(record.level)], thread_index);
+    output += prefix;
+    output.append(record.text, record.length);
+    output += '\n';
+}
+
+static void write_all(const std::string& output) {
+    size_t written = 0;
+    while (written < output.size()) {
+        ssize_t count = write(STDERR_FILENO, output.data() + written, output.size() - written);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return;
+        }
+        written += count;
+    }
+}
+
+// Drains every ring into a single write. Returns whether some ring was at
+// least half full, in which case the flusher goes again without sleeping.
+static bool flush_rings(std::string& output) {
+    output.clear();
+    bool backlogged = false;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        for (LogRing* ring : registry) {
+            uint64_t head = ring->head.load(std::memory_order_relaxed);
+            uint64_t tail = ring->tail.load(std::memory_order_acquire);
+            backlogged |= tail - head >= LOG_RING_CAPACITY / 2;
+            for (; head != tail; ++head) {
+                append_record(output, ring->thread_index, ring->records[head & (LOG_RING_CAPACITY - 1)]);
+            }
+            ring->head.store(head, std::memory_order_release);
+
+            uint64_t dropped = ring->dropped.load(std::memory_order_relaxed);
+            if (dropped != ring->dropped_reported) {
+                char line[96];
+                snprintf(line, sizeof line, "log ring of thread %u full, %llu messages dropped\n",
+                         ring->thread_index, static_cast<unsigned long long>(dropped - ring->dropped_reported));
+                output += line;
+                ring->dropped_reported = dropped;
+            }
+        }
+    }
+    write_all(output);
+    return backlogged;
+}
+
+static void run_flusher() {
+    std::string output;
+    std::unique_lock<std::mutex> lock(flusher_mutex);
+    while (!flusher_stopping) {
+        lock.unlock();
+        bool backlogged = flush_rings(output);
+        lock.lock();
+        if (!backlogged && !flusher_stopping) {
+            flusher_wakeup.wait_for(lock, LOG_FLUSH_INTERVAL);
+        }
+    }
+    lock.unlock();
+    flush_rings(output);
+}
+
+void start_logger() {
+    std::lock_guard<std::mutex> lock(flusher_mutex);
+    if (flusher.joinable()) {
+        return;
+    }
+    flusher_stopping = false;
+    flusher = std::thread(run_flusher);
+    static bool registered = false;
+    if (!registered) {
+        std::atexit(stop_logger);
+        registered = true;
+    }
+}
+
+void stop_logger() {
+    {
+        std::lock_guard<std::mutex> lock(flusher_mutex);
+        if (!flusher.joinable()) {
+            return;
+        }
+        flusher_stopping = true;
+    }
+    flusher_wakeup.notify_one();
+    flusher.join();
+}
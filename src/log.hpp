@@ -0,0 +1,56 @@
+#ifndef LOG_HPP
+#define LOG_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum class LogLevel : uint8_t {
+    OFF,
+    ERROR,
+    WARN,
+    INFO,
+    DEBUG
+};
+
+// Messages longer than this are truncated.
+const size_t LOG_MESSAGE_SIZE = 232;
+
+// Records per thread; a thread that logs faster than the flusher drains
+// drops the overflow and the flusher reports how many were lost.
+const size_t LOG_RING_CAPACITY = 1024;
+
+extern std::atomic<LogLevel> log_threshold;
+
+inline bool log_enabled(LogLevel level) {
+    return level <= log_threshold.load(std::memory_order_relaxed);
+}
+
+void set_log_level(LogLevel level);
+bool parse_log_level(const std::string& name, LogLevel& level);
+
+// Formats the message into the calling thread's ring and returns; the write
+// to stderr happens on the flusher thread. Never blocks.
+void log_write(LogLevel level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+// Starts the flusher thread. Whatever is still queued when the process
+// exits is flushed by an atexit handler.
+void start_logger();
+void stop_logger();
+
+// The arguments are only evaluated when the level is enabled, so disabled
+// debug logging costs one relaxed load.
+#define LOG_AT(level, ...) \
+    do { \
+        if (log_enabled(level)) { \
+            log_write(level, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_ERROR(...) LOG_AT(LogLevel::ERROR, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LogLevel::WARN, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LogLevel::INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LogLevel::DEBUG, __VA_ARGS__)
+
+#endif
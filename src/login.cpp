@@ -0,0 +1,119 @@
+#include "login.hpp"
+#include "credentials.hpp"
+#include "log.hpp"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <sys/eventfd.h>
+
+struct QueuedLogin {
+    LoginInbox* inbox;
+    LoginJob job;
+};
+
+// One queue for every reactor, so a burst of logins on one thread can use
+// all of the workers.
+static std::mutex queue_mutex;
+static std::condition_variable queue_ready;
+static std::deque<QueuedLogin> queue;
+static size_t pending_limit = 0;
+static size_t pending = 0;
+
+// Swapped whole on reload. Each verification holds its own reference, so
+// the old mapping goes away once the last login using it is done. Null
+// until a credential file is loaded, which accepts every login.
+static std::shared_ptr<const CredentialStore> credential_store;
+
+LoginInbox::~LoginInbox() {
+    if (event_fd != -1) {
+        close(event_fd);
+    }
+}
+
+bool LoginInbox::open() {
+    if (event_fd == -1) {
+        event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    }
+    return event_fd != -1;
+}
+
+void LoginInbox::deliver(const LoginJob& job) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.push_back(job);
+    }
+    uint64_t one = 1;
+    ssize_t written = write(event_fd, &one, sizeof one);
+    (void)written;
+}
+
+// The eventfd is reset before taking the list, so a login delivered in
+// between leaves it readable rather than being missed.
+void LoginInbox::drain(std::vector<LoginJob>& results) {
+    uint64_t count;
+    ssize_t read_size = read(event_fd, &count, sizeof count);
+    (void)read_size;
+
+    results.clear();
+    std::lock_guard<std::mutex> lock(mutex);
+    results.swap(finished);
+}
+
+static void run_login_worker() {
+    while (true) {
+        QueuedLogin login;
+        {
+            std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_ready.wait(lock, [] { return !queue.empty(); });
+            login = queue.front();
+            queue.pop_front();
+        }
+
+        login.job.status_code = verify_login(login.job.credentials);
+        login.inbox->deliver(login.job);
+
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        --pending;
+    }
+}
+
+void start_login_workers(unsigned threads, size_t max_pending) {
+    pending_limit = max_pending;
+    for (unsigned i = 0; i < threads; ++i) {
+        std::thread(run_login_worker).detach();
+    }
+}
+
+bool submit_login(LoginInbox& inbox, const LoginJob& job) {
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        if (pending >= pending_limit) {
+            return false;
+        }
+        ++pending;
+        queue.push_back({&inbox, job});
+    }
+    queue_ready.notify_one();
+    return true;
+}
+
+bool load_credentials(const char* path) {
+    auto store = std::make_shared<CredentialStore>();
+    std::string error;
+    if (!store->open(path, error)) {
+        LOG_ERROR("Error loading credentials from %s: %s", path, error.c_str());
+        return false;
+    }
+    LOG_INFO("Loaded %zu credentials from %s", store->size(), path);
+    std::atomic_store(&credential_store, std::shared_ptr<const CredentialStore>(std::move(store)));
+    return true;
+}
+
+uint16_t verify_login(const UserCredentials& credentials) {
+    std::shared_ptr<const CredentialStore> store = std::atomic_load(&credential_store);
+    if (!store) {
+        return LOGIN_STATUS_OK;
+    }
+    return store->verify(credentials) ? LOGIN_STATUS_OK : LOGIN_STATUS_FAILED;
+}
@@ -0,0 +1,55 @@
+#ifndef LOGIN_HPP
+#define LOGIN_HPP
+
+#include "common.hpp"
+#include <mutex>
+#include <vector>
+
+// A login handed to the workers. tag identifies the session it came from,
+// so that a verdict for a connection closed in the meantime is dropped
+// instead of reaching whatever connection reuses the fd.
+struct LoginJob {
+    uint64_t tag;
+    UserCredentials credentials;
+    uint16_t status_code;
+};
+
+// Where a reactor's finished logins are delivered. Workers append under the
+// lock and bump the eventfd, which the reactor waits on along with its
+// sockets.
+class LoginInbox {
+public:
+    ~LoginInbox();
+
+    bool open();
+    int fd() const { return event_fd; }
+
+    void deliver(const LoginJob& job);
+
+    // Moves every finished login into results, replacing their contents.
+    void drain(std::vector<LoginJob>& results);
+
+private:
+    std::mutex mutex;
+    std::vector<LoginJob> finished;
+    int event_fd = -1;
+};
+
+// Starts the worker threads shared by all reactors. At most max_pending
+// logins are queued or being verified at any time.
+void start_login_workers(unsigned threads, size_t max_pending);
+
+// Queues a login whose verdict goes to inbox. Returns false, queuing
+// nothing, when max_pending logins are already pending.
+bool submit_login(LoginInbox& inbox, const LoginJob& job);
+
+// Maps the credential file at path and makes it the one logins are checked
+// against, replacing any loaded before once the logins already using that
+// one are done. On failure the current file stays in use.
+bool load_credentials(const char* path);
+
+// Runs on a login worker, so it may take as long as it likes. Without a
+// credential file every login is accepted.
+uint16_t verify_login(const UserCredentials& credentials);
+
+#endif
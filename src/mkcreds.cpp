@@ -0,0 +1,99 @@
+#include "credentials.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/random.h>
+
+bool read_credentials(FILE* input, const char* name, std::vector<CredentialRecord>& records);
+bool fill_salt(uint8_t* salt);
+
+// Builds a credential file for the server's --credentials option from
+// "username password" lines. The password is everything after the
+// whitespace following the username.
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " INPUT|- OUTPUT\n";
+        return 1;
+    }
+
+    FILE* input = strcmp(argv[1], "-") == 0 ? stdin : fopen(argv[1], "r");
+    if (input == nullptr) {
+        std::cerr << "Error opening " << argv[1] << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+    std::vector<CredentialRecord> records;
+    bool read = read_credentials(input, argv[1], records);
+    if (input != stdin) {
+        fclose(input);
+    }
+    if (!read) {
+        return 1;
+    }
+
+    std::string error;
+    if (!write_credential_file(argv[2], records, error)) {
+        std::cerr << "Error writing " << argv[2] << ": " << error << "\n";
+        return 1;
+    }
+    std::cout << "Wrote " << records.size() << " credentials to " << argv[2] << "\n";
+    return 0;
+}
+
+bool read_credentials(FILE* input, const char* name, std::vector<CredentialRecord>& records) {
+    char* line = nullptr;
+    size_t capacity = 0;
+    ssize_t length;
+    size_t line_number = 0;
+    bool ok = true;
+    while (ok && (length = getline(&line, &capacity, input)) != -1) {
+        ++line_number;
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = '\0';
+        }
+        if (length == 0) {
+            continue;
+        }
+
+        size_t username_size = strcspn(line, " \t");
+        const char* password = line + username_size + strspn(line + username_size, " \t");
+        size_t password_size = strlen(password);
+        if (username_size == 0 || password_size == 0) {
+            std::cerr << name << ":" << line_number << ": expected a username and a password\n";
+            ok = false;
+        } else if (username_size >= USER_BYTE_SIZE || password_size >= PASS_BYTE_SIZE) {
+            std::cerr << name << ":" << line_number << ": username or password too long\n";
+            ok = false;
+        } else {
+            UserCredentials credentials;
+            memset(&credentials, 0, sizeof credentials);
+            memcpy(credentials.username, line, username_size);
+            memcpy(credentials.password, password, password_size);
+
+            CredentialRecord record;
+            memcpy(record.username, credentials.username, USER_BYTE_SIZE);
+            if (!fill_salt(record.salt)) {
+                std::cerr << "Error generating salt: " << strerror(errno) << "\n";
+                ok = false;
+            }
+            hash_credential_secret(record.salt, credentials.password, record.digest);
+            records.push_back(record);
+        }
+    }
+    free(line);
+    return ok;
+}
+
+bool fill_salt(uint8_t* salt) {
+    size_t filled = 0;
+    while (filled < CREDENTIAL_SALT_SIZE) {
+        ssize_t count = getrandom(salt + filled, CREDENTIAL_SALT_SIZE - filled, 0);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count == -1) {
+            return false;
+        }
+        filled += count;
+    }
+    return true;
+}
@@ -0,0 +1,92 @@
+#include "pool.hpp"
+#include <new>
+
+static size_t size_class(size_t size) {
+    size_t index = 0;
+    while ((BUFFER_POOL_MIN_SIZE << index) < size) {
+        ++index;
+    }
+    return index;
+}
+
+BufferPool::~BufferPool() {
+    for (FreeBuffer* head : free_lists) {
+        while (head != nullptr) {
+            FreeBuffer* next = head->next;
+            ::operator delete(head);
+            head = next;
+        }
+    }
+}
+
+PooledBuffer BufferPool::acquire(size_t size) {
+    if (size > BUFFER_POOL_MAX_SIZE) {
+        ++miss_count;
+        return {static_cast<uint8_t*>(::operator new(size)), size};
+    }
+
+    size_t index = size_class(size);
+    size_t capacity = BUFFER_POOL_MIN_SIZE << index;
+    FreeBuffer* head = free_lists[index];
+    if (head == nullptr) {
+        ++miss_count;
+        return {static_cast<uint8_t*>(::operator new(capacity)), capacity};
+    }
+
+    ++hit_count;
+    free_lists[index] = head->next;
+    class_held_bytes[index] -= capacity;
+    held_bytes -= capacity;
+    return {reinterpret_cast<uint8_t*>(head), capacity};
+}
+
+void BufferPool::release(PooledBuffer& buffer) {
+    if (buffer.data == nullptr) {
+        return;
+    }
+
+    size_t index = size_class(buffer.capacity);
+    if (buffer.capacity > BUFFER_POOL_MAX_SIZE || class_held_bytes[index] + buffer.capacity > BUFFER_POOL_MAX_HELD_BYTES) {
+        ::operator delete(buffer.data);
+    } else {
+        FreeBuffer* head = reinterpret_cast<FreeBuffer*>(buffer.data);
+        head->next = free_lists[index];
+        free_lists[index] = head;
+        class_held_bytes[index] += buffer.capacity;
+        held_bytes += buffer.capacity;
+    }
+
+    buffer = PooledBuffer();
+}
+
+Slab::Slab(size_t object_size) {
+    const size_t alignment = alignof(std::max_align_t);
+    if (object_size < sizeof(FreeObject)) {
+        object_size = sizeof(FreeObject);
+    }
+    this->object_size = (object_size + alignment - 1) / alignment * alignment;
+}
+
+void* Slab::allocate() {
+    if (free_list == nullptr) {
+        uint8_t* block = static_cast<uint8_t*>(::operator new(object_size * SLAB_BLOCK_OBJECTS));
+        for (size_t i = SLAB_BLOCK_OBJECTS; i > 0; --i) {
+            FreeObject* object = reinterpret_cast<FreeObject*>(block + (i - 1) * object_size);
+            object->next = free_list;
+            free_list = object;
+        }
+        total_objects += SLAB_BLOCK_OBJECTS;
+    }
+
+    FreeObject* object = free_list;
+    free_list = object->next;
+    ++used_objects;
+    return object;
+}
+
+void Slab::deallocate(void* object) {
+    FreeObject* head = static_cast<FreeObject*>(object);
+    head->next = free_list;
+    free_list = head;
+    --used_objects;
+}
@@ -0,0 +1,100 @@
+#ifndef POOL_HPP
+#define POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+// Byte buffer borrowed from a BufferPool. capacity is the size class the
+// buffer came from, which may be larger than what was asked for.
+struct PooledBuffer {
+    uint8_t* data = nullptr;
+    size_t capacity = 0;
+};
+
+// Power-of-two size-classed free lists of byte buffers, from
+// BUFFER_POOL_MIN_SIZE up to BUFFER_POOL_MAX_SIZE. Each class keeps at most
+// BUFFER_POOL_MAX_HELD_BYTES idle; anything beyond that, and requests above
+// the largest class, go straight to the heap. Not thread-safe: each reactor
+// thread owns its own pool.
+const size_t BUFFER_POOL_MIN_SHIFT = 10;
+const size_t BUFFER_POOL_CLASS_COUNT = 10;
+const size_t BUFFER_POOL_MIN_SIZE = size_t(1) << BUFFER_POOL_MIN_SHIFT;
+const size_t BUFFER_POOL_MAX_SIZE = BUFFER_POOL_MIN_SIZE << (BUFFER_POOL_CLASS_COUNT - 1);
+const size_t BUFFER_POOL_MAX_HELD_BYTES = 4 * 1024 * 1024;
+
+class BufferPool {
+public:
+    BufferPool() = default;
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+    ~BufferPool();
+
+    PooledBuffer acquire(size_t size);
+    void release(PooledBuffer& buffer);
+
+    uint64_t hits() const { return hit_count; }
+    uint64_t misses() const { return miss_count; }
+    size_t bytes_held() const { return held_bytes; }
+
+private:
+    struct FreeBuffer {
+        FreeBuffer* next;
+    };
+
+    FreeBuffer* free_lists[BUFFER_POOL_CLASS_COUNT] = {};
+    size_t class_held_bytes[BUFFER_POOL_CLASS_COUNT] = {};
+    size_t held_bytes = 0;
+    uint64_t hit_count = 0;
+    uint64_t miss_count = 0;
+};
+
+// Fixed-size object slab: objects are carved out of SLAB_BLOCK_OBJECTS-sized
+// blocks and recycled through an intrusive free list. Blocks are never
+// returned to the heap, so the slab only grows to the peak object count.
+const size_t SLAB_BLOCK_OBJECTS = 256;
+
+class Slab {
+public:
+    explicit Slab(size_t object_size);
+    Slab(const Slab&) = delete;
+    Slab& operator=(const Slab&) = delete;
+
+    void* allocate();
+    void deallocate(void* object);
+
+    size_t in_use() const { return used_objects; }
+    size_t capacity() const { return total_objects; }
+
+private:
+    struct FreeObject {
+        FreeObject* next;
+    };
+
+    size_t object_size;
+    FreeObject* free_list = nullptr;
+    size_t used_objects = 0;
+    size_t total_objects = 0;
+};
+
+// Per-thread slab for objects of type T. The slab is intentionally leaked so
+// thread_local objects torn down after it can still hand their objects back.
+template <typename T>
+Slab& slab_for() {
+    static thread_local Slab* instance = new Slab(sizeof(T));
+    return *instance;
+}
+
+template <typename T, typename... Args>
+T* slab_new(Args&&... args) {
+    return new (slab_for<T>().allocate()) T(std::forward<Args>(args)...);
+}
+
+template <typename T>
+void slab_delete(T* object) {
+    object->~T();
+    slab_for<T>().deallocate(object);
+}
+
+#endif
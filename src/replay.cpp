@@ -0,0 +1,676 @@
+#include "capture.hpp"
+#include "common.hpp"
+#include "histogram.hpp"
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <deque>
+#include <unordered_map>
+
+const char DEFAULT_SERVER_IP[] = "127.0.0.1";
+const int MAX_EVENTS = 256;
+const uint64_t NANOSECONDS_PER_SECOND = 1000000000;
+const uint64_t NANOSECONDS_PER_MILLISECOND = 1000000;
+const uint64_t DRAIN_TIMEOUT_NS = 2 * NANOSECONDS_PER_SECOND;
+const size_t RECEIVE_CHUNK_SIZE = 64 * 1024;
+
+struct ReplayConfig {
+    const char* capture = nullptr;
+    const char* server_ip = DEFAULT_SERVER_IP;
+    const char* port = DEFAULT_PORT;
+    // Multiplies the captured pace; 2 replays twice as fast.
+    double speed = 1;
+    std::string username = "admin";
+    std::string password = "12345";
+};
+
+// A frame waiting for its response, with the time it was due to be sent.
+struct PendingFrame {
+    uint64_t due;
+    bool login;
+};
+
+// One replayed connection, standing in for a captured one. Frames are
+// queued as they come due, also while the connect is still in progress.
+// A captured close is replayed once every response is in, so that the
+// server never drops answers the original client did get.
+struct ReplayConnection {
+    int fd = -1;
+    bool connected = false;
+    bool closing = false;
+    std::deque<PendingFrame> pending;
+    std::vector<uint8_t> output;
+    size_t output_offset = 0;
+    std::vector<uint8_t> input;
+    size_t input_bytes = 0;
+    // Stream response payload still to be skipped.
+    uint64_t stream_remaining = 0;
+};
+
+struct ReplayStats {
+    Histogram latency;
+    uint64_t connections = 0;
+    uint64_t frames = 0;
+    uint64_t messages = 0;
+    uint64_t responses = 0;
+    uint64_t resumes = 0;
+    uint64_t skipped_frames = 0;
+    uint64_t failed_connections = 0;
+    uint64_t failed_logins = 0;
+    uint64_t unanswered = 0;
+    uint64_t records = 0;
+    uint64_t lag_sum = 0;
+    uint64_t lag_max = 0;
+};
+
+struct Replay {
+    const ReplayConfig* config;
+    const addrinfo* address;
+    int epoll_fd = -1;
+    std::unordered_map<uint32_t, ReplayConnection> connections;
+    UserCredentials credentials;
+    ReplayStats stats;
+};
+
+bool parse_arguments(int argc, char* argv[], ReplayConfig& config);
+uint64_t now_ns();
+bool is_valid_record(const CaptureRecord& record);
+std::vector<const CaptureRecord*> schedule_records(const CaptureFile& capture, uint64_t& invalid);
+void run_replay(Replay& replay, const std::vector<const CaptureRecord*>& schedule);
+void replay_record(Replay& replay, const CaptureRecord& record, uint64_t due);
+bool open_connection(Replay& replay, uint32_t id);
+void handle_connected(Replay& replay, uint32_t id, ReplayConnection& connection);
+void handle_readable(Replay& replay, uint32_t id, ReplayConnection& connection);
+bool process_responses(Replay& replay, ReplayConnection& connection);
+void complete_response(Replay& replay, ReplayConnection& connection);
+void queue_frame(Replay& replay, ReplayConnection& connection, const CaptureRecord& record);
+bool flush_output(ReplayConnection& connection);
+void finish_close(Replay& replay, uint32_t id, ReplayConnection& connection);
+void close_connection(Replay& replay, uint32_t id);
+void print_report(const ReplayConfig& config, const ReplayStats& stats, uint64_t span, uint64_t elapsed);
+
+int main(int argc, char* argv[]) {
+    ReplayConfig config;
+    if (!parse_arguments(argc, argv, config)) {
+        std::cerr << "Usage: " << argv[0] << " CAPTURE [server_ip] [port] [--speed FACTOR]"
+                  << " [--username NAME] [--password PASS]\n";
+        return 1;
+    }
+
+    CaptureFile capture;
+    std::string error;
+    if (!capture.open(config.capture, error)) {
+        std::cerr << "Error opening " << config.capture << ": " << error << "\n";
+        return 1;
+    }
+    uint64_t invalid = 0;
+    std::vector<const CaptureRecord*> schedule = schedule_records(capture, invalid);
+    if (invalid > 0) {
+        std::cerr << config.capture << ": skipped " << invalid << " torn or invalid records\n";
+    }
+    if (schedule.empty()) {
+        std::cerr << config.capture << ": no connection was captured from its start\n";
+        return 1;
+    }
+
+    struct addrinfo hints, *address;
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int status = getaddrinfo(config.server_ip, config.port, &hints, &address);
+    if (status != 0) {
+        std::cerr << "getaddrinfo error: " << gai_strerror(status) << "\n";
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    Replay replay;
+    replay.config = &config;
+    replay.address = address;
+    memset(&replay.credentials, 0, sizeof replay.credentials);
+    memcpy(replay.credentials.username, config.username.data(), config.username.size());
+    memcpy(replay.credentials.password, config.password.data(), config.password.size());
+    replay.epoll_fd = epoll_create1(0);
+    if (replay.epoll_fd == -1) {
+        std::cerr << "Error creating epoll instance: " << strerror(errno) << "\n";
+        freeaddrinfo(address);
+        return 1;
+    }
+
+    uint64_t start = now_ns();
+    run_replay(replay, schedule);
+    uint64_t elapsed = now_ns() - start;
+    close(replay.epoll_fd);
+    freeaddrinfo(address);
+
+    print_report(config, replay.stats, schedule.back()->time_ns - schedule.front()->time_ns, elapsed);
+    bool failed = replay.stats.failed_connections > 0 || replay.stats.failed_logins > 0;
+    return failed ? 1 : 0;
+}
+
+bool parse_arguments(int argc, char* argv[], ReplayConfig& config) {
+    int positional = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+        size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) == 0 && eq != std::string::npos) {
+            value = arg.substr(eq + 1);
+            arg = arg.substr(0, eq);
+        } else if (arg.rfind("--", 0) == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << "\n";
+                return false;
+            }
+            value = argv[++i];
+        }
+
+        if (arg == "--speed") {
+            config.speed = atof(value.c_str());
+            if (config.speed <= 0) {
+                std::cerr << "Invalid speed factor: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--username") {
+            if (value.size() >= USER_BYTE_SIZE) {
+                std::cerr << "Username too long: " << value << "\n";
+                return false;
+            }
+            config.username = value;
+        } else if (arg == "--password") {
+            if (value.size() >= PASS_BYTE_SIZE) {
+                std::cerr << "Password too long\n";
+                return false;
+            }
+            config.password = value;
+        } else if (arg.rfind("--", 0) == 0 || positional == 3) {
+            std::cerr << "Unknown argument: " << arg << "\n";
+            return false;
+        } else if (positional == 0) {
+            config.capture = argv[i];
+            ++positional;
+        } else if (positional++ == 1) {
+            config.server_ip = argv[i];
+        } else {
+            config.port = argv[i];
+        }
+    }
+    return config.capture != nullptr;
+}
+
+uint64_t now_ns() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * NANOSECONDS_PER_SECOND + now.tv_nsec;
+}
+
+// Whether the record holds something the server could have written: a
+// known event for a numbered connection and, for a frame, a request type
+// with a size that type can have. A stream's size is its payload, which
+// any 32-bit value can be.
+bool is_valid_record(const CaptureRecord& record) {
+    if (record.connection == 0) {
+        return false;
+    }
+    if (record.event == CaptureEvent::OPEN || record.event == CaptureEvent::CLOSE) {
+        return record.size == 0 && record.count == 0 && record.message_type == 0 && record.message_sequence == 0;
+    }
+    if (record.event != CaptureEvent::FRAME) {
+        return false;
+    }
+    if (record.message_type != ECHO_BATCH_REQUEST_TYPE && record.count != 1) {
+        return false;
+    }
+    switch (record.message_type) {
+    case LOGIN_REQUEST_TYPE:
+        return record.size == LOGIN_REQUEST_BYTE_SIZE;
+    case RESUME_REQUEST_TYPE:
+        return record.size == RESUME_REQUEST_BYTE_SIZE;
+    case STATS_REQUEST_TYPE:
+        return record.size == STATS_REQUEST_BYTE_SIZE;
+    case ECHO_REQUEST_TYPE:
+        return record.size >= HEADER_BYTE_SIZE + SIZE_BYTE_SIZE && record.size <= HEADER_BYTE_SIZE + SIZE_BYTE_SIZE + UINT16_MAX;
+    case ECHO_BATCH_REQUEST_TYPE:
+        return record.size >= ECHO_BATCH_HEADER_BYTE_SIZE && record.size <= UINT16_MAX;
+    case ECHO_STREAM_REQUEST_TYPE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// The used records in time order. Chunks are mostly in order already, so
+// the sort has little to do. Once the ring has wrapped, connections that
+// opened before the oldest surviving chunk are left out: their login is
+// gone, and the server would refuse their echoes.
+// Records that fail is_valid_record are counted in invalid and left out.
+std::vector<const CaptureRecord*> schedule_records(const CaptureFile& capture, uint64_t& invalid) {
+    std::vector<const CaptureRecord*> records;
+    for (uint64_t i = 0; i < capture.capacity(); ++i) {
+        const CaptureRecord& record = capture.record(i);
+        if (__atomic_load_n(reinterpret_cast<const uint8_t*>(&record.event), __ATOMIC_ACQUIRE) == 0) {
+            continue;
+        }
+        if (is_valid_record(record)) {
+            records.push_back(&record);
+        } else {
+            ++invalid;
+        }
+    }
+    std::stable_sort(records.begin(), records.end(), [](const CaptureRecord* left, const CaptureRecord* right) {
+        return left->time_ns < right->time_ns;
+    });
+
+    std::unordered_map<uint32_t, bool> opened;
+    std::vector<const CaptureRecord*> schedule;
+    for (const CaptureRecord* record : records) {
+        if (record->event == CaptureEvent::OPEN) {
+            opened[record->connection] = true;
+        }
+        if (opened.count(record->connection) != 0) {
+            schedule.push_back(record);
+        }
+    }
+    return schedule;
+}
+
+// Each record goes out when its offset from the first record, divided by
+// the speed factor, has elapsed. The loop sleeps in epoll_wait until
+// within a millisecond of the next record and polls without blocking for
+// the rest, so records are sent close to their schedule. Latency is
+// measured from that schedule, so a replayer or server that falls behind
+// shows up in it.
+void run_replay(Replay& replay, const std::vector<const CaptureRecord*>& schedule) {
+    const ReplayConfig& config = *replay.config;
+    uint64_t first = schedule.front()->time_ns;
+    uint64_t start = now_ns();
+    size_t next = 0;
+    uint64_t drain_deadline = 0;
+    std::vector<epoll_event> events(MAX_EVENTS);
+
+    while (true) {
+        uint64_t now = now_ns();
+        while (next < schedule.size()) {
+            uint64_t due = start + static_cast<uint64_t>((schedule[next]->time_ns - first) / config.speed);
+            if (due > now) {
+                break;
+            }
+            uint64_t lag = now - due;
+            ++replay.stats.records;
+            replay.stats.lag_sum += lag;
+            replay.stats.lag_max = std::max(replay.stats.lag_max, lag);
+            replay_record(replay, *schedule[next], due);
+            ++next;
+        }
+        if (next == schedule.size() && replay.connections.empty()) {
+            break;
+        }
+
+        int timeout;
+        if (next < schedule.size()) {
+            uint64_t due = start + static_cast<uint64_t>((schedule[next]->time_ns - first) / config.speed);
+            timeout = static_cast<int>((due - std::min(due, now)) / NANOSECONDS_PER_MILLISECOND);
+        } else {
+            // The whole capture is out; wait a while for the last responses.
+            if (drain_deadline == 0) {
+                drain_deadline = now + DRAIN_TIMEOUT_NS;
+            }
+            if (now >= drain_deadline) {
+                break;
+            }
+            timeout = static_cast<int>((drain_deadline - now + NANOSECONDS_PER_MILLISECOND - 1) / NANOSECONDS_PER_MILLISECOND);
+        }
+
+        int event_count = epoll_wait(replay.epoll_fd, events.data(), MAX_EVENTS, timeout);
+        if (event_count == -1 && errno != EINTR) {
+            std::cerr << "Error during epoll_wait: " << strerror(errno) << "\n";
+            break;
+        }
+        for (int i = 0; i < event_count; ++i) {
+            uint32_t id = events[i].data.u32;
+            auto found = replay.connections.find(id);
+            if (found == replay.connections.end()) {
+                continue;
+            }
+            ReplayConnection& connection = found->second;
+            if (!connection.connected) {
+                handle_connected(replay, id, connection);
+                continue;
+            }
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                handle_readable(replay, id, connection);
+                if (replay.connections.count(id) == 0) {
+                    continue;
+                }
+            }
+            if ((events[i].events & EPOLLOUT) && !flush_output(connection)) {
+                close_connection(replay, id);
+            }
+        }
+    }
+
+    std::vector<uint32_t> remaining;
+    for (const auto& entry : replay.connections) {
+        remaining.push_back(entry.first);
+    }
+    for (uint32_t id : remaining) {
+        close_connection(replay, id);
+    }
+}
+
+void replay_record(Replay& replay, const CaptureRecord& record, uint64_t due) {
+    if (record.event == CaptureEvent::OPEN) {
+        ++replay.stats.connections;
+        if (!open_connection(replay, record.connection)) {
+            ++replay.stats.failed_connections;
+        }
+        return;
+    }
+
+    auto found = replay.connections.find(record.connection);
+    if (found == replay.connections.end()) {
+        // The connection failed or the server closed it.
+        if (record.event == CaptureEvent::FRAME) {
+            ++replay.stats.skipped_frames;
+        }
+        return;
+    }
+    ReplayConnection& connection = found->second;
+    if (record.event == CaptureEvent::CLOSE) {
+        connection.closing = true;
+        finish_close(replay, record.connection, connection);
+        return;
+    }
+
+    queue_frame(replay, connection, record);
+    connection.pending.push_back({due, record.message_type == LOGIN_REQUEST_TYPE || record.message_type == RESUME_REQUEST_TYPE});
+    if (connection.connected && !flush_output(connection)) {
+        close_connection(replay, record.connection);
+    }
+}
+
+bool open_connection(Replay& replay, uint32_t id) {
+    const addrinfo* address = replay.address;
+    int fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+    if (fd == -1) {
+        std::cerr << "Error creating socket: " << strerror(errno) << "\n";
+        return false;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+    if (connect(fd, address->ai_addr, address->ai_addrlen) == -1 && errno != EINPROGRESS) {
+        std::cerr << "Error connecting: " << strerror(errno) << "\n";
+        close(fd);
+        return false;
+    }
+
+    epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+    event.data.u32 = id;
+    if (epoll_ctl(replay.epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        std::cerr << "Error adding socket to epoll: " << strerror(errno) << "\n";
+        close(fd);
+        return false;
+    }
+
+    ReplayConnection& connection = replay.connections[id];
+    connection.fd = fd;
+    connection.input.resize(RECEIVE_CHUNK_SIZE);
+    return true;
+}
+
+void handle_connected(Replay& replay, uint32_t id, ReplayConnection& connection) {
+    int error = 0;
+    socklen_t length = sizeof error;
+    if (getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &length) == -1 || error != 0) {
+        std::cerr << "Error connecting: " << strerror(error != 0 ? error : errno) << "\n";
+        ++replay.stats.failed_connections;
+        close_connection(replay, id);
+        return;
+    }
+
+    connection.connected = true;
+    if (!flush_output(connection)) {
+        close_connection(replay, id);
+        return;
+    }
+    finish_close(replay, id, connection);
+}
+
+void handle_readable(Replay& replay, uint32_t id, ReplayConnection& connection) {
+    while (true) {
+        if (connection.input.size() - connection.input_bytes < RECEIVE_CHUNK_SIZE) {
+            connection.input.resize(connection.input_bytes + RECEIVE_CHUNK_SIZE);
+        }
+        ssize_t count = recv(connection.fd, connection.input.data() + connection.input_bytes,
+                             connection.input.size() - connection.input_bytes, 0);
+        if (count > 0) {
+            connection.input_bytes += count;
+            continue;
+        }
+        if (count == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count == -1) {
+            std::cerr << "Error reading from server: " << strerror(errno) << "\n";
+        }
+        // The server hung up. Answers already in count; a login still
+        // waiting for one was refused.
+        process_responses(replay, connection);
+        if (!connection.pending.empty() && connection.pending.front().login) {
+            ++replay.stats.failed_logins;
+        } else {
+            replay.stats.unanswered += connection.pending.size();
+        }
+        connection.pending.clear();
+        close_connection(replay, id);
+        return;
+    }
+
+    if (!process_responses(replay, connection)) {
+        close_connection(replay, id);
+        return;
+    }
+    finish_close(replay, id, connection);
+}
+
+// Responses come back in request order, so each one answers the oldest
+// pending frame. Their contents are not checked: replay reproduces the
+// shape of the traffic, not its payloads. A stream response is complete
+// once its whole payload is in.
+bool process_responses(Replay& replay, ReplayConnection& connection) {
+    size_t offset = 0;
+    while (offset < connection.input_bytes) {
+        size_t available = connection.input_bytes - offset;
+        if (connection.stream_remaining > 0) {
+            size_t skipped = std::min<uint64_t>(available, connection.stream_remaining);
+            offset += skipped;
+            connection.stream_remaining -= skipped;
+            if (connection.stream_remaining == 0) {
+                complete_response(replay, connection);
+            }
+            continue;
+        }
+        if (available < HEADER_BYTE_SIZE) {
+            break;
+        }
+
+        const uint8_t* frame = connection.input.data() + offset;
+        Header header;
+        deserialize_header(header, frame);
+        if (header.message_size < HEADER_BYTE_SIZE || connection.pending.empty()) {
+            std::cerr << "Unexpected frame type " << static_cast<int>(header.message_type) << " from server\n";
+            return false;
+        }
+        if (available < header.message_size) {
+            break;
+        }
+        offset += header.message_size;
+
+        if (header.message_type == ECHO_STREAM_RESPONSE_TYPE) {
+            EchoStreamHeader stream;
+            deserialize_echo_stream_header(stream, frame);
+            connection.stream_remaining = stream.message_size;
+            if (connection.stream_remaining > 0) {
+                continue;
+            }
+        } else if (header.message_type == LOGIN_RESPONSE_TYPE) {
+            LoginResponse response;
+            deserialize_login_response(response, frame);
+            if (response.status_code != LOGIN_STATUS_OK) {
+                ++replay.stats.failed_logins;
+                connection.pending.clear();
+                return false;
+            }
+        }
+        complete_response(replay, connection);
+    }
+
+    connection.input_bytes -= offset;
+    memmove(connection.input.data(), connection.input.data() + offset, connection.input_bytes);
+    return true;
+}
+
+void complete_response(Replay& replay, ReplayConnection& connection) {
+    replay.stats.latency.record(now_ns() - connection.pending.front().due);
+    ++replay.stats.responses;
+    connection.pending.pop_front();
+}
+
+// Rebuilds a frame of the captured type, size and sequence, with a zero
+// payload encrypted under nothing in particular: the server decrypts
+// whatever it is given, at the same cost. A resume is sent as a login,
+// since the ticket it carried was only ever valid on the original server.
+// A stream's payload is queued whole.
+void queue_frame(Replay& replay, ReplayConnection& connection, const CaptureRecord& record) {
+    std::vector<uint8_t>& output = connection.output;
+    size_t offset = output.size();
+    uint8_t sequence = record.message_sequence;
+    ++replay.stats.frames;
+
+    if (record.message_type == LOGIN_REQUEST_TYPE || record.message_type == RESUME_REQUEST_TYPE) {
+        if (record.message_type == RESUME_REQUEST_TYPE) {
+            ++replay.stats.resumes;
+        }
+        LoginRequest request = {{LOGIN_REQUEST_BYTE_SIZE, LOGIN_REQUEST_TYPE, sequence}, replay.credentials};
+        output.resize(offset + LOGIN_REQUEST_BYTE_SIZE);
+        serialize_login_request(request, output.data() + offset);
+    } else if (record.message_type == STATS_REQUEST_TYPE) {
+        output.resize(offset + STATS_REQUEST_BYTE_SIZE);
+        serialize_header({STATS_REQUEST_BYTE_SIZE, STATS_REQUEST_TYPE, sequence}, output.data() + offset);
+    } else if (record.message_type == ECHO_STREAM_REQUEST_TYPE) {
+        output.resize(offset + ECHO_STREAM_HEADER_BYTE_SIZE + record.size);
+        EchoStreamHeader request = {{ECHO_STREAM_HEADER_BYTE_SIZE, ECHO_STREAM_REQUEST_TYPE, sequence}, record.size};
+        serialize_echo_stream_header(request, output.data() + offset);
+        ++replay.stats.messages;
+    } else if (record.message_type == ECHO_BATCH_REQUEST_TYPE) {
+        // The payload bytes are split evenly over the captured number of
+        // messages, as many of them as the frame has room for.
+        uint16_t frame_size = static_cast<uint16_t>(std::max<uint32_t>(record.size, ECHO_BATCH_HEADER_BYTE_SIZE));
+        size_t room = (frame_size - ECHO_BATCH_HEADER_BYTE_SIZE) / ECHO_BATCH_ENTRY_HEADER_BYTE_SIZE;
+        uint16_t count = static_cast<uint16_t>(std::min<size_t>(record.count, room));
+        size_t payload = frame_size - ECHO_BATCH_HEADER_BYTE_SIZE - count * ECHO_BATCH_ENTRY_HEADER_BYTE_SIZE;
+        output.resize(offset + frame_size);
+        uint8_t* frame = output.data() + offset;
+        uint8_t* position = serialize_header({frame_size, ECHO_BATCH_REQUEST_TYPE, sequence}, frame);
+        uint16_t netcount = htons(count);
+        position[0] = netcount & 0xFF;
+        position[1] = (netcount >> 8) & 0xFF;
+        position += SIZE_BYTE_SIZE;
+        for (uint16_t i = 0; i < count; ++i) {
+            uint16_t size = static_cast<uint16_t>(payload / count + (i < payload % count ? 1 : 0));
+            EchoBatchEntryView entry = {static_cast<uint8_t>(sequence + i), size,
+                                        std::string_view(reinterpret_cast<const char*>(position + ECHO_BATCH_ENTRY_HEADER_BYTE_SIZE), size)};
+            position = serialize_echo_batch_entry(entry, position);
+        }
+        replay.stats.messages += count;
+    } else {
+        uint16_t frame_size = static_cast<uint16_t>(std::max<uint32_t>(record.size, HEADER_BYTE_SIZE + SIZE_BYTE_SIZE));
+        uint16_t size = frame_size - HEADER_BYTE_SIZE - SIZE_BYTE_SIZE;
+        output.resize(offset + frame_size);
+        uint8_t* frame = output.data() + offset;
+        uint8_t* payload = frame + HEADER_BYTE_SIZE + SIZE_BYTE_SIZE;
+        EchoRequestView request = {{frame_size, ECHO_REQUEST_TYPE, sequence}, size,
+                                   std::string_view(reinterpret_cast<const char*>(payload), size)};
+        serialize_echo_request(request, frame);
+        ++replay.stats.messages;
+    }
+}
+
+// Sends as much queued output as the socket takes. Whatever is left goes
+// out on the next EPOLLOUT edge.
+bool flush_output(ReplayConnection& connection) {
+    while (connection.output_offset < connection.output.size()) {
+        ssize_t count = send(connection.fd, connection.output.data() + connection.output_offset,
+                             connection.output.size() - connection.output_offset, MSG_NOSIGNAL);
+        if (count == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Error sending to server: " << strerror(errno) << "\n";
+            return false;
+        }
+        connection.output_offset += count;
+    }
+    connection.output.clear();
+    connection.output_offset = 0;
+    return true;
+}
+
+// Carries out a captured close once nothing is left to send or to wait
+// for, which frees the connection.
+void finish_close(Replay& replay, uint32_t id, ReplayConnection& connection) {
+    if (connection.closing && connection.connected && connection.output.empty() && connection.pending.empty()) {
+        close_connection(replay, id);
+    }
+}
+
+void close_connection(Replay& replay, uint32_t id) {
+    auto found = replay.connections.find(id);
+    if (found == replay.connections.end()) {
+        return;
+    }
+    ReplayConnection& connection = found->second;
+    replay.stats.unanswered += connection.pending.size();
+    epoll_ctl(replay.epoll_fd, EPOLL_CTL_DEL, connection.fd, nullptr);
+    close(connection.fd);
+    replay.connections.erase(found);
+}
+
+void print_report(const ReplayConfig& config, const ReplayStats& stats, uint64_t span, uint64_t elapsed) {
+    double captured = span / 1e9;
+    double seconds = elapsed / 1e9;
+    printf("replayed:    %llu connections, %llu frames (%llu messages) captured over %.1f s, in %.1f s at speed %g\n",
+           static_cast<unsigned long long>(stats.connections),
+           static_cast<unsigned long long>(stats.frames),
+           static_cast<unsigned long long>(stats.messages), captured, seconds, config.speed);
+    printf("responses:   %llu answered, %llu unanswered (%.0f frames/s)\n",
+           static_cast<unsigned long long>(stats.responses),
+           static_cast<unsigned long long>(stats.unanswered), stats.responses / seconds);
+    printf("errors:      %llu failed to connect, %llu failed logins, %llu frames on closed connections, %llu resumes sent as logins\n",
+           static_cast<unsigned long long>(stats.failed_connections),
+           static_cast<unsigned long long>(stats.failed_logins),
+           static_cast<unsigned long long>(stats.skipped_frames),
+           static_cast<unsigned long long>(stats.resumes));
+    printf("latency us:  min %.1f  mean %.1f  p50 %.1f  p99 %.1f  p99.9 %.1f  max %.1f\n",
+           stats.latency.min() / 1e3, stats.latency.mean() / 1e3,
+           stats.latency.percentile(50) / 1e3, stats.latency.percentile(99) / 1e3,
+           stats.latency.percentile(99.9) / 1e3, stats.latency.max() / 1e3);
+    printf("schedule us: mean lag %.1f  max lag %.1f\n",
+           stats.records == 0 ? 0.0 : stats.lag_sum / 1e3 / stats.records,
+           stats.lag_max / 1e3);
+}
@@ -1,80 +1,775 @@
+#include "capture.hpp"
 #include "common.hpp"
+#include "log.hpp"
+#include "login.hpp"
+#include "pool.hpp"
+#include "stats.hpp"
+#include "ticket.hpp"
+#include "timer.hpp"
+#include "uring.hpp"
 #include <fcntl.h>
-#include <unordered_map>
+#include <algorithm>
+#include <atomic>
+#include <csignal>
+#include <cstdlib>
+#include <ctime>
+#include <functional>
+#include <thread>
+#include <poll.h>
 #include <sys/epoll.h>
+#include <linux/errqueue.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <climits>
 
 
 const int INITIAL_EVENT_LIST_SIZE = 10;
-const int LISTEN_MAX_CONNECTIONS = 10;
+const int DEFAULT_LISTEN_BACKLOG = SOMAXCONN;
 const int INITIAL_BUFFER_SIZE = 1024;
+const size_t INITIAL_SESSION_TABLE_SIZE = 1024;
 const int EPOLL_FLAGS = EPOLLIN | EPOLLET;
+const int MAX_IOVECS = IOV_MAX < 64 ? IOV_MAX : 64;
+const size_t OUTPUT_HIGH_WATER_MARK = 256 * 1024;
+const size_t OUTPUT_LOW_WATER_MARK = 64 * 1024;
+const size_t STREAM_RECEIVE_SIZE = 16 * 1024;
+const unsigned URING_ENTRIES = 4096;
+const uint16_t URING_BUFFER_GROUP = 0;
+const unsigned URING_BUFFER_COUNT = 1024;
+const size_t URING_BUFFER_SIZE = 4096;
+const int BACKEND_UNAVAILABLE = -1;
+const int TIMER_TICK_MS = 100;
+const uint32_t ZEROCOPY_CLOSE_GRACE_TICKS = 2000 / TIMER_TICK_MS;
+const uint64_t LOW_LATENCY_IDLE_SPIN_NS = 50 * 1000 * 1000;
+const int DEFAULT_BUSY_POLL_US = 50;
+const size_t DEFAULT_READ_BUDGET = 64 * 1024;
 
-std::unordered_map<int, UserCredentials> logged_users;
+enum class Backend {
+    EPOLL,
+    URING
+};
 
-#ifndef NDEBUG
-void printLogged_users(const std::unordered_map<int, UserCredentials>& logged_users) {
-    std::cout << "Logged Users:" << std::endl;
-    for (const auto& pair : logged_users) {
-        std::cout << "User ID: " << pair.first << std::endl;
-        std::cout << "  Username: " << pair.second.username << std::endl;
-        std::cout << "  Password: " << pair.second.password << std::endl;
+// Options from the command line.
+struct ServerConfig {
+    const char* port = DEFAULT_PORT;
+    int threads = 1;
+    Backend backend = Backend::EPOLL;
+    int backlog = DEFAULT_LISTEN_BACKLOG;
+    // Open connections across all reactors; 0 admits every connection.
+    int max_connections = 0;
+    // Unix socket path for the stats dump; empty for none.
+    std::string stats_socket;
+
+    // Timer ticks. idle_timeout closes connections that neither send a
+    // message nor take a response for that long, login_timeout those that
+    // have not logged in that long after connecting. 0 for none.
+    uint32_t idle_timeout = 0;
+    uint32_t login_timeout = 0;
+
+    // Flushes of at least this many staged bytes go out with MSG_ZEROCOPY;
+    // 0 for never.
+    size_t zerocopy_threshold = 0;
+
+    // Logins are verified by login_threads workers shared by all reactors,
+    // with at most login_queue of them waiting or in progress.
+    int login_threads = 2;
+    int login_queue = 1024;
+    // Credential file to check logins against; empty accepts every login.
+    std::string credentials;
+    // Seconds a resumption ticket stays valid; 0 issues none and refuses
+    // resume requests.
+    uint32_t ticket_lifetime = 0;
+
+    // Reactor i is pinned to reactor_cpus[i % size] when any are given.
+    std::vector<int> reactor_cpus;
+    // Reactors spin on non-blocking waits and accepted sockets are tuned
+    // for latency, with busy_poll_us as their SO_BUSY_POLL.
+    bool low_latency = false;
+    int busy_poll_us = DEFAULT_BUSY_POLL_US;
+
+    // Capture file the frames of every connection are recorded into, in a
+    // ring of capture_records records; empty for none.
+    std::string capture;
+    uint64_t capture_records = DEFAULT_CAPTURE_RECORDS;
+
+    // Bytes one connection may read per reactor pass; 0 for no limit.
+    size_t read_budget = DEFAULT_READ_BUDGET;
+    // Per-connection limits per second; 0 for no limit.
+    uint64_t rate_limit_messages = 0;
+    uint64_t rate_limit_bytes = 0;
+};
+
+ServerConfig config;
+
+// Open client connections across all reactor threads, checked against
+// config.max_connections when a connection is accepted.
+std::atomic<int> active_connections(0);
+
+// Where the incremental parser is within the current frame.
+// STREAM is the payload of an echo stream, which is passed through in
+// whatever chunks it arrives in rather than gathered into a frame. LOGIN
+// waits for the verdict on a login handed to the workers: nothing after it
+// is parsed, and the socket is not read, until it is in.
+enum class ParseState : uint8_t {
+    HEADER,
+    SIZE,
+    BODY,
+    STREAM,
+    LOGIN
+};
+
+// Receive buffer and write queue of an open connection, allocated from the
+// reactor's slab when the connection is accepted. Bytes in
+// [read_offset, write_offset) have been received but not yet consumed by the
+// parser; read_offset always points at the start of the current frame, so a
+// partial frame is kept whole.
+//
+// Responses are built in place over their request frames and staged as
+// iovecs into the receive buffer. Each flush writes the owned output queue
+// followed by the staged views with a single writev; whatever the socket does
+// not take is copied into output before the receive buffer is reused.
+// Unsent output occupies [output_offset, output_offset + output_bytes).
+//
+// Both buffers are borrowed from the reactor's BufferPool only while they
+// hold data, so idle connections pin no buffer memory.
+//
+// A MSG_ZEROCOPY send leaves the kernel reading the receive buffer the
+// staged responses point into until it reports the send complete on the
+// socket's error queue. That buffer is set aside in zerocopy_pinned, with
+// the id of the last send from it, and receiving continues in a fresh one.
+// zerocopy_next_id mirrors the kernel's per-socket count of zero-copy sends.
+//
+// A connection closed while sends are still pinned stays open, with its
+// read side shut, until their notifications are in. A peer that stops
+// reading would hold it there for good, so it only waits
+// ZEROCOPY_CLOSE_GRACE_TICKS. After that the socket is reset with
+// SO_LINGER {1, 0}, which drops whatever is still queued from the pinned
+// pages unsent, and the session is released.
+struct ZeroCopyPin {
+    PooledBuffer buffer;
+    uint32_t last_send_id;
+    size_t bytes;
+};
+
+struct Connection {
+    PooledBuffer buffer;
+    size_t read_offset = 0;
+    size_t write_offset = 0;
+
+    std::vector<struct iovec> staged;
+    size_t staged_head = 0;
+    size_t staged_bytes = 0;
+    PooledBuffer output;
+    size_t output_offset = 0;
+    size_t output_bytes = 0;
+
+    // Echo stream in progress: payload bytes still to come, and the cipher
+    // state after the last chunk.
+    uint32_t stream_remaining = 0;
+    uint32_t stream_key = 0;
+
+    // Connection number in the traffic capture, 0 when none is running.
+    uint32_t capture_id = 0;
+
+    // Tick the connection's timer wheel entry is filed under while it has
+    // one, so that closing it can take the entry out.
+    uint32_t timer_deadline = 0;
+    bool timer_scheduled = false;
+
+    // Token buckets of the per-connection rate limits, refilled from
+    // tokens_refilled whenever they are checked. A frame is never split,
+    // so they can go into debt, which the connection then waits out.
+    double message_tokens = 0;
+    double byte_tokens = 0;
+    uint64_t tokens_refilled = 0;
+
+    // epoll backend only. ready_queued is set while the connection waits
+    // on the reactor's ready list for another read budget.
+    bool ready_queued = false;
+    std::vector<ZeroCopyPin> zerocopy_pinned;
+    size_t zerocopy_head = 0;
+    uint32_t zerocopy_next_id = 0;
+    bool zerocopy = false;
+
+    // io_uring backend only. A send owns the buffer it was submitted from
+    // until it completes, so new responses go to a fresh output buffer.
+    PooledBuffer inflight;
+    size_t inflight_offset = 0;
+    size_t inflight_bytes = 0;
+    uint64_t send_started = 0;
+    bool send_in_flight = false;
+    bool receive_armed = false;
+
+    // Closed, but kept until the last outstanding send or zero-copy
+    // notification is in.
+    bool closing = false;
+};
+
+// Hot per-connection state, one cache line per fd in the reactor's session
+// table.
+struct alignas(64) Session {
+    // Bumped whenever the slot is reused. It travels in the epoll event data,
+    // so an event queued for a closed fd never reaches the next connection
+    // that gets the same fd.
+    uint32_t generation = 0;
+    bool open = false;
+    bool logged_in = false;
+    // Set while more than OUTPUT_HIGH_WATER_MARK bytes wait to be sent, so
+    // a slow reader cannot grow its write queue without bound.
+    bool reading_paused = false;
+    // Set while the connection waits out going over its rate limit.
+    bool throttled = false;
+    ParseState state = ParseState::HEADER;
+    // Derived from the credentials once, at login; the credentials
+    // themselves are not kept.
+    EchoKey key = {0, 0};
+    Header header = {0, 0, 0};
+    uint32_t frame_size = 0;
+    uint32_t events = EPOLL_FLAGS;
+    // Timer wheel ticks. active_tick is refreshed with a plain store on
+    // every message and every send that makes progress.
+    uint32_t opened_tick = 0;
+    uint32_t active_tick = 0;
+    uint64_t messages = 0;
+    uint64_t bytes_received = 0;
+    uint64_t bytes_sent = 0;
+    Connection* connection = nullptr;
+};
+
+static_assert(sizeof(Session) == 64, "Session should fill exactly one cache line");
+
+// io_uring completions carry the operation and fd in user_data. Unlike the
+// epoll backend no generation is needed: an fd is only closed once none of
+// its operations are still in flight, so it cannot be reused under them.
+enum class UringOp : uint8_t {
+    ACCEPT,
+    LISTEN_POLL,
+    RECEIVE,
+    SEND,
+    CANCEL,
+    TIMER,
+    LOGIN,
+    THROTTLE
+};
+
+// Every reactor thread owns its sessions, so the table is never shared.
+thread_local std::vector<Session> sessions;
+thread_local KeystreamCache keystream_cache;
+thread_local BufferPool buffer_pool;
+thread_local bool uring_multishot_receive = true;
+// Descriptor held in reserve so a reactor that hits EMFILE can free one
+// slot, accept the pending connection and close it right away.
+thread_local int spare_fd = -1;
+// Every open session has at most one entry in the wheel, tagged like its
+// epoll events. When the entry fires the session's deadline is recomputed
+// and the entry rescheduled if the session has been active since, so
+// refreshing a timer never touches the wheel.
+thread_local TimerWheel timer_wheel;
+thread_local std::vector<uint64_t> timer_due;
+thread_local std::vector<int> timer_expired;
+thread_local uint64_t timer_expirations = 0;
+thread_local LoginInbox login_inbox;
+thread_local std::vector<LoginJob> login_results;
+// Low-latency mode: when the reactor last finished handling events. It
+// spins on non-blocking waits until LOW_LATENCY_IDLE_SPIN_NS after that,
+// so a busy reactor never pays for a wakeup, and then blocks again so an
+// idle one does not burn its core for good.
+thread_local uint64_t spin_idle_since = 0;
+// epoll backend: connections that used up their read budget with input
+// possibly still in the socket. No new edge will come for it, so they are
+// read again from here, round-robin, one budget per pass.
+thread_local std::vector<uint64_t> ready_sessions;
+thread_local std::vector<uint64_t> ready_serving;
+// Throttled sessions by the time their buckets have refilled, earliest
+// first, behind a timerfd armed for the earliest of them at throttle_armed.
+thread_local std::vector<std::pair<uint64_t, uint64_t>> throttle_queue;
+thread_local std::vector<int> throttle_resumed;
+thread_local int throttle_fd = -1;
+thread_local uint64_t throttle_armed = 0;
+thread_local uint64_t throttle_expirations = 0;
+
+void printLogged_users(const std::vector<Session>& sessions) {
+    LOG_DEBUG("Logged Users:");
+    for (size_t fd = 0; fd < sessions.size(); ++fd) {
+        if (!sessions[fd].open || !sessions[fd].logged_in) {
+            continue;
+        }
+        LOG_DEBUG("User ID: %zu, username checksum: %d, password checksum: %d", fd,
+                  sessions[fd].key.username_sum, sessions[fd].key.password_sum);
     }
 }
-#endif
 
-std::string (&decrypt_echo_message)(const UserCredentials &credentials, uint8_t message_sequence, const std::string& cipher_text) = encrypt_echo_message;
-int setup_listener_socket(const char* port);
-void set_non_blocking(int socket_fd);
+bool parse_arguments(int argc, char* argv[], ServerConfig& config);
+bool parse_cpu_list(const std::string& value, std::vector<int>& cpus);
+int reactor_cpu(int index);
+void reload_credentials_on_signal(sigset_t signals);
+int setup_listener_socket(const char* port, bool reuse_port);
+int run_reactor(int server_fd, int cpu);
+int run_epoll_reactor(int server_fd);
+int run_uring_reactor(int server_fd);
 int handle_new_connection(int epoll_fd, int server_fd);
-bool receive_header(int client_fd, std::vector<uint8_t>& buffer, Header& header);
+bool admit_connection(int client_fd);
+void tune_low_latency_socket(int client_fd);
+int spin_timeout(uint64_t now);
+void account_wait(uint64_t wait_start, uint64_t now, bool blocked);
+void account_work(uint64_t work_start, uint64_t now);
+void publish_reactor_stats();
+bool shed_connection(int server_fd);
+uint64_t session_tag(int fd, uint32_t generation);
+Session& open_session(int fd);
+Session* find_session(uint64_t tag);
+int session_fd(const Session& session);
+void reserve_receive_buffer(Connection& connection, size_t size);
+bool receive_data(int client_fd, Connection& connection, bool& closed, size_t& received);
+bool process_frames(Session& session);
 bool is_valid_request(const Header& header);
-bool handle_login_request(int client_fd, const Header& header, std::vector<uint8_t>& buffer);
-bool handle_echo_request(int client_fd, const Header& header, std::vector<uint8_t>& buffer);
-bool send_response(int client_fd, const std::vector<uint8_t>& buffer, int response_size);
+void capture_request(const Session& session, const uint8_t* frame);
+bool handle_login_request(Session& session, uint8_t* frame);
+bool finish_login(Session& session, const LoginJob& login);
+size_t serialize_login_success(const Session& session, uint8_t type, uint8_t* buffer);
+bool handle_resume_request(Session& session, uint8_t* frame);
+bool reading_parked(const Session& session);
+bool handle_echo_request(Session& session, uint8_t* frame);
+bool handle_stats_request(Session& session, uint8_t* frame);
+bool handle_echo_batch_request(Session& session, uint8_t* frame);
+bool handle_echo_stream_request(Session& session, uint8_t* frame);
+void handle_echo_stream_chunk(Session& session, uint8_t* chunk, size_t size);
+void stage_response(Connection& connection, const uint8_t* response, size_t response_size);
+void append_output(Connection& connection, const uint8_t* data, size_t size);
+void consume_output(Connection& connection, size_t count);
+void spill_staged(Connection& connection);
+bool flush_output(int epoll_fd, int client_fd, Session& session);
+void enable_zerocopy(int client_fd, Connection& connection);
+void pin_receive_buffer(Connection& connection, size_t bytes, bool extend);
+void reap_zerocopy_completions(int client_fd, Connection& connection);
+void release_zerocopy_pins(Connection& connection, uint32_t last_send_id, bool copied);
+bool timeouts_enabled();
+int open_tick_timer();
+bool rate_limits_enabled();
+void charge_rate_limits(Connection& connection, uint32_t messages, uint64_t bytes);
+void enforce_rate_limits(Session& session, int client_fd);
+void arm_throttle_timer(uint64_t due);
+void expire_throttles(std::vector<int>& resumed);
+bool session_deadline(const Session& session, uint32_t& deadline);
+void expire_sessions(uint64_t ticks, std::vector<int>& expired);
 
-void handle_client_data(int epoll_fd, int client_fd);
+void handle_client_event(int epoll_fd, uint64_t tag, uint32_t events);
+void handle_client_data(int epoll_fd, int client_fd, Session& session);
+void handle_client_writable(int epoll_fd, int client_fd, Session& session);
+void handle_login_results(int epoll_fd);
+bool serve_ready_sessions(int epoll_fd);
 void close_client_connection(int epoll_fd, int client_fd);
-uint16_t user_login(int client_fd, const UserCredentials &user_credentials);
+void release_session(int client_fd);
+
+uint64_t uring_tag(UringOp op, int fd);
+void uring_arm_accept(IoUring& ring, int server_fd);
+void uring_arm_listen_poll(IoUring& ring, int server_fd);
+void uring_arm_timer(IoUring& ring, UringOp op, int timer_fd, uint64_t& expirations);
+void uring_arm_login_inbox(IoUring& ring);
+void uring_arm_receive(IoUring& ring, int client_fd, Connection& connection);
+void uring_submit_send(IoUring& ring, int client_fd, Connection& connection);
+void uring_handle_receive(IoUring& ring, int client_fd, const io_uring_cqe& cqe);
+bool uring_receive(IoUring& ring, int client_fd, Session& session, uint8_t* data, size_t size);
+void uring_handle_send(IoUring& ring, int client_fd, const io_uring_cqe& cqe);
+bool uring_process_input(IoUring& ring, int client_fd, Session& session);
+void uring_pause_receive(IoUring& ring, int client_fd);
+void uring_handle_login_results(IoUring& ring);
+void uring_close_connection(IoUring& ring, int client_fd);
+void uring_finish_close(int client_fd);
 
 int main(int argc, char* argv[]) {
-    const char* port = (argc > 1) ? argv[1] : DEFAULT_PORT;
+    if (!parse_arguments(argc, argv, config)) {
+        std::cerr << "Usage: " << argv[0] << " [port] [--threads N] [--backend=epoll|uring] [--backlog N] [--max-connections N] [--stats-socket PATH] [--idle-timeout SECONDS] [--login-timeout SECONDS] [--zerocopy-threshold BYTES] [--login-threads N] [--login-queue N] [--credentials PATH] [--ticket-lifetime SECONDS] [--reactor-cpus LIST] [--low-latency] [--busy-poll-us N] [--capture PATH] [--capture-records N] [--read-budget BYTES] [--rate-limit-msgs N] [--rate-limit-bytes N] [--log-level=off|error|warn|info|debug]\n";
+        return 1;
+    }
 
-    int server_fd = setup_listener_socket(port);
-    if (server_fd < 0) {
-        #ifndef NDEBUG
-        std::cout << "Error setting up the listener socket\n";
-        #endif
+    // SIGHUP reloads the credential file. It is blocked before any thread
+    // starts, so every thread inherits the mask and only the watcher below
+    // ever takes it.
+    sigset_t reload_signals;
+    sigemptyset(&reload_signals);
+    sigaddset(&reload_signals, SIGHUP);
+    if (!config.credentials.empty()) {
+        pthread_sigmask(SIG_BLOCK, &reload_signals, nullptr);
+    }
+    start_logger();
+    if (config.backend == Backend::URING && config.zerocopy_threshold > 0) {
+        LOG_WARN("--zerocopy-threshold is only supported by the epoll backend, ignoring it");
+    }
+    if (!config.credentials.empty()) {
+        if (!load_credentials(config.credentials.c_str())) {
+            return 1;
+        }
+        std::thread(reload_credentials_on_signal, reload_signals).detach();
+    }
+    if (config.ticket_lifetime > 0 && !init_ticket_keys()) {
+        LOG_ERROR("Error generating ticket keys: %s", strerror(errno));
         return 1;
     }
+    if (!config.capture.empty()) {
+        std::string error;
+        if (!start_capture(config.capture.c_str(), config.capture_records, error)) {
+            LOG_ERROR("Error creating capture file %s: %s", config.capture.c_str(), error.c_str());
+            return 1;
+        }
+    }
+    start_login_workers(config.login_threads, config.login_queue);
+
+    // One SO_REUSEPORT listener per reactor lets the kernel spread incoming
+    // connections across threads without a shared accept queue.
+    bool reuse_port = config.threads > 1;
+    std::vector<int> listeners;
+    for (int i = 0; i < config.threads; ++i) {
+        int server_fd = setup_listener_socket(config.port, reuse_port);
+        if (server_fd < 0) {
+            LOG_ERROR("Error setting up the listener socket");
+            for (int fd : listeners) {
+                close(fd);
+            }
+            return 1;
+        }
+        // Steers SO_REUSEPORT to the listener whose reactor runs on the
+        // CPU that took the SYN, so a connection's packets and its reactor
+        // share a core.
+        int cpu = reactor_cpu(i);
+        if (cpu >= 0 && setsockopt(server_fd, SOL_SOCKET, SO_INCOMING_CPU, &cpu, sizeof cpu) == -1) {
+            LOG_WARN("Error setting SO_INCOMING_CPU: %s", strerror(errno));
+        }
+        listeners.push_back(server_fd);
+    }
+
+    // Writes to a peer that reset the connection must fail with EPIPE
+    // instead of killing the process.
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!config.stats_socket.empty()) {
+        int stats_fd = open_stats_socket(config.stats_socket.c_str());
+        if (stats_fd < 0) {
+            for (int fd : listeners) {
+                close(fd);
+            }
+            return 1;
+        }
+        std::thread(serve_stats_socket, stats_fd, std::cref(active_connections)).detach();
+    }
+
+    std::vector<std::thread> workers;
+    for (int i = 1; i < config.threads; ++i) {
+        workers.emplace_back(run_reactor, listeners[i], reactor_cpu(i));
+    }
+
+    int result = run_reactor(listeners[0], reactor_cpu(0));
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    return result;
+}
+
+bool parse_arguments(int argc, char* argv[], ServerConfig& config) {
+    bool port_set = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value;
+        if (arg == "--low-latency") {
+            config.low_latency = true;
+            continue;
+        }
+        size_t eq = arg.find('=');
+        if (arg.rfind("--", 0) == 0 && eq != std::string::npos) {
+            value = arg.substr(eq + 1);
+            arg = arg.substr(0, eq);
+        } else if (arg.rfind("--", 0) == 0) {
+            if (i + 1 >= argc) {
+                std::cerr << "Missing value for " << arg << "\n";
+                return false;
+            }
+            value = argv[++i];
+        }
+
+        if (arg == "--threads") {
+            config.threads = atoi(value.c_str());
+            if (config.threads < 1) {
+                std::cerr << "Invalid thread count: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--backlog") {
+            config.backlog = atoi(value.c_str());
+            if (config.backlog < 1) {
+                std::cerr << "Invalid backlog: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--max-connections") {
+            config.max_connections = atoi(value.c_str());
+            if (config.max_connections < 0) {
+                std::cerr << "Invalid connection limit: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--idle-timeout" || arg == "--login-timeout") {
+            long long seconds = atoll(value.c_str());
+            const long long max_seconds = static_cast<long long>(TIMER_MAX_DELAY) * TIMER_TICK_MS / 1000;
+            if (seconds < 0 || seconds > max_seconds) {
+                std::cerr << "Invalid timeout: " << value << " (at most " << max_seconds << " seconds)\n";
+                return false;
+            }
+            uint64_t ticks = static_cast<uint64_t>(seconds) * 1000 / TIMER_TICK_MS;
+            (arg == "--idle-timeout" ? config.idle_timeout : config.login_timeout) = static_cast<uint32_t>(ticks);
+        } else if (arg == "--zerocopy-threshold") {
+            long long threshold = atoll(value.c_str());
+            if (threshold < 0) {
+                std::cerr << "Invalid zero-copy threshold: " << value << "\n";
+                return false;
+            }
+            config.zerocopy_threshold = static_cast<size_t>(threshold);
+        } else if (arg == "--login-threads") {
+            config.login_threads = atoi(value.c_str());
+            if (config.login_threads < 1) {
+                std::cerr << "Invalid login thread count: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--login-queue") {
+            config.login_queue = atoi(value.c_str());
+            if (config.login_queue < 1) {
+                std::cerr << "Invalid login queue depth: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--ticket-lifetime") {
+            int seconds = atoi(value.c_str());
+            if (seconds < 0) {
+                std::cerr << "Invalid ticket lifetime: " << value << "\n";
+                return false;
+            }
+            config.ticket_lifetime = static_cast<uint32_t>(seconds);
+        } else if (arg == "--reactor-cpus") {
+            if (!parse_cpu_list(value, config.reactor_cpus)) {
+                std::cerr << "Invalid CPU list: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--busy-poll-us") {
+            config.busy_poll_us = atoi(value.c_str());
+            if (config.busy_poll_us < 0) {
+                std::cerr << "Invalid busy poll time: " << value << "\n";
+                return false;
+            }
+        } else if (arg == "--capture-records") {
+            long long records = atoll(value.c_str());
+            if (records < 1) {
+                std::cerr << "Invalid capture size: " << value << "\n";
+                return false;
+            }
+            config.capture_records = static_cast<uint64_t>(records);
+        } else if (arg == "--read-budget") {
+            long long budget = atoll(value.c_str());
+            if (budget < 0) {
+                std::cerr << "Invalid read budget: " << value << "\n";
+                return false;
+            }
+            config.read_budget = static_cast<size_t>(budget);
+        } else if (arg == "--rate-limit-msgs" || arg == "--rate-limit-bytes") {
+            long long rate = atoll(value.c_str());
+            if (rate < 0) {
+                std::cerr << "Invalid rate limit: " << value << "\n";
+                return false;
+            }
+            (arg == "--rate-limit-msgs" ? config.rate_limit_messages : config.rate_limit_bytes) = static_cast<uint64_t>(rate);
+        } else if (arg == "--capture") {
+            config.capture = value;
+        } else if (arg == "--credentials") {
+            config.credentials = value;
+        } else if (arg == "--stats-socket") {
+            config.stats_socket = value;
+        } else if (arg == "--log-level") {
+            LogLevel level;
+            if (!parse_log_level(value, level)) {
+                std::cerr << "Unknown log level: " << value << "\n";
+                return false;
+            }
+            set_log_level(level);
+        } else if (arg == "--backend") {
+            if (value == "epoll") {
+                config.backend = Backend::EPOLL;
+            } else if (value == "uring") {
+                config.backend = Backend::URING;
+            } else {
+                std::cerr << "Unknown backend: " << value << "\n";
+                return false;
+            }
+        } else if (arg.rfind("--", 0) == 0 || port_set) {
+            std::cerr << "Unknown argument: " << arg << "\n";
+            return false;
+        } else {
+            config.port = argv[i];
+            port_set = true;
+        }
+    }
+    return true;
+}
+
+// Accepts comma-separated CPU numbers and inclusive ranges, e.g. 2,4-7.
+bool parse_cpu_list(const std::string& value, std::vector<int>& cpus) {
+    cpus.clear();
+    size_t start = 0;
+    while (start <= value.size()) {
+        size_t end = value.find(',', start);
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+        std::string item = value.substr(start, end - start);
+        size_t dash = item.find('-');
+        char* rest;
+        long low = strtol(item.c_str(), &rest, 10);
+        long high = low;
+        if (dash != std::string::npos && rest == item.c_str() + dash) {
+            high = strtol(item.c_str() + dash + 1, &rest, 10);
+        }
+        if (item.empty() || *rest != '\0' || low < 0 || high < low || high >= CPU_SETSIZE) {
+            return false;
+        }
+        for (long cpu = low; cpu <= high; ++cpu) {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+        start = end + 1;
+    }
+    return true;
+}
+
+// The CPU reactor index is pinned to, or -1 for none.
+int reactor_cpu(int index) {
+    if (config.reactor_cpus.empty()) {
+        return -1;
+    }
+    return config.reactor_cpus[index % config.reactor_cpus.size()];
+}
+
+// Runs on its own thread, so the file is mapped and checked outside signal
+// context and off the reactors. Logins in progress finish against the file
+// they started with; a file that fails to load leaves the old one in use.
+void reload_credentials_on_signal(sigset_t signals) {
+    while (true) {
+        int signal_number;
+        if (sigwait(&signals, &signal_number) != 0) {
+            continue;
+        }
+        LOG_INFO("Reloading credentials from %s", config.credentials.c_str());
+        load_credentials(config.credentials.c_str());
+    }
+}
+
+// io_uring falls back to epoll when the kernel lacks the features it needs.
+int run_reactor(int server_fd, int cpu) {
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        int error = pthread_setaffinity_np(pthread_self(), sizeof cpus, &cpus);
+        if (error != 0) {
+            LOG_WARN("Error pinning reactor to CPU %d: %s", cpu, strerror(error));
+        }
+    }
+    spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (config.backend == Backend::URING) {
+        int result = run_uring_reactor(server_fd);
+        if (result != BACKEND_UNAVAILABLE) {
+            return result;
+        }
+        LOG_WARN("io_uring backend unavailable, falling back to epoll");
+    }
+    return run_epoll_reactor(server_fd);
+}
 
+int run_epoll_reactor(int server_fd) {
     int epoll_fd = epoll_create1(0);
     if (epoll_fd == -1) {
-        #ifndef NDEBUG
-        std::cout << "Error creating epoll instance: " << strerror(errno) << "\n";
-        #endif
+        LOG_ERROR("Error creating epoll instance: %s", strerror(errno));
         close(server_fd);
         return 1;
     }
 
     struct epoll_event ev;
     ev.events = EPOLLIN;
-    ev.data.fd = server_fd;
+    ev.data.u64 = session_tag(server_fd, 0);
     if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, server_fd, &ev) == -1) {
-        #ifndef NDEBUG
-        std::cout << "Error adding server socket to epoll: " << strerror(errno) << "\n";
-        #endif
+        LOG_ERROR("Error adding server socket to epoll: %s", strerror(errno));
+        close(server_fd);
+        close(epoll_fd);
+        return 1;
+    }
+
+    if (!login_inbox.open()) {
+        LOG_ERROR("Error setting up the login inbox: %s", strerror(errno));
+        close(server_fd);
+        close(epoll_fd);
+        return 1;
+    }
+    // Level-triggered: a login delivered while the inbox is being drained
+    // leaves the eventfd readable for the next round.
+    ev.events = EPOLLIN;
+    ev.data.u64 = session_tag(login_inbox.fd(), 0);
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, login_inbox.fd(), &ev) == -1) {
+        LOG_ERROR("Error setting up the login inbox: %s", strerror(errno));
         close(server_fd);
         close(epoll_fd);
         return 1;
     }
 
+    int timer_fd = -1;
+    if (timeouts_enabled()) {
+        timer_fd = open_tick_timer();
+        ev.events = EPOLLIN;
+        ev.data.u64 = session_tag(timer_fd, 0);
+        if (timer_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev) == -1) {
+            LOG_ERROR("Error setting up the connection timer: %s", strerror(errno));
+            if (timer_fd != -1) {
+                close(timer_fd);
+            }
+            close(server_fd);
+            close(epoll_fd);
+            return 1;
+        }
+    }
+
+    if (rate_limits_enabled()) {
+        throttle_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        ev.events = EPOLLIN;
+        ev.data.u64 = session_tag(throttle_fd, 0);
+        if (throttle_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, throttle_fd, &ev) == -1) {
+            LOG_ERROR("Error setting up the throttle timer: %s", strerror(errno));
+            if (throttle_fd != -1) {
+                close(throttle_fd);
+            }
+            if (timer_fd != -1) {
+                close(timer_fd);
+            }
+            close(server_fd);
+            close(epoll_fd);
+            return 1;
+        }
+    }
+
     std::vector<struct epoll_event> events(INITIAL_EVENT_LIST_SIZE);
     while (true) {
-        int nfds = epoll_wait(epoll_fd, events.data(), events.size(), -1);
+        publish_reactor_stats();
+        int timeout = -1;
+        uint64_t wait_start = 0;
+        if (config.low_latency) {
+            wait_start = stats_clock();
+            timeout = spin_timeout(wait_start);
+        }
+        // Connections on the ready list still have input, so only poll.
+        if (!ready_sessions.empty()) {
+            timeout = 0;
+        }
+        int nfds = epoll_wait(epoll_fd, events.data(), events.size(), timeout);
+        uint64_t work_start = 0;
+        if (config.low_latency) {
+            work_start = stats_clock();
+            account_wait(wait_start, work_start, timeout != 0);
+        }
         if (nfds == -1) {
-            #ifndef NDEBUG
-            std::cout << "Error during epoll_wait: " << strerror(errno) << "\n";
-            #endif
+            LOG_ERROR("Error during epoll_wait: %s", strerror(errno));
             if (errno != EINTR) {
                 break;
             }
@@ -82,28 +777,56 @@ int main(int argc, char* argv[]) {
         }
 
         for (int n = 0; n < nfds; ++n) {
-            if (events[n].data.fd == server_fd) {
+            if (events[n].data.u64 == session_tag(server_fd, 0)) {
                 if (handle_new_connection(epoll_fd, server_fd) == -1) {
-                    #ifndef NDEBUG
-                    std::cout << "Error handling new connection. Continuing with other connections.\n";
-                    #endif
+                    LOG_WARN("Error handling new connection. Continuing with other connections");
+                }
+            } else if (events[n].data.u64 == session_tag(login_inbox.fd(), 0)) {
+                handle_login_results(epoll_fd);
+            } else if (timer_fd != -1 && events[n].data.u64 == session_tag(timer_fd, 0)) {
+                uint64_t ticks;
+                if (read(timer_fd, &ticks, sizeof ticks) == sizeof ticks) {
+                    expire_sessions(ticks, timer_expired);
+                    for (int fd : timer_expired) {
+                        close_client_connection(epoll_fd, fd);
+                    }
+                }
+            } else if (throttle_fd != -1 && events[n].data.u64 == session_tag(throttle_fd, 0)) {
+                uint64_t expirations;
+                if (read(throttle_fd, &expirations, sizeof expirations) == sizeof expirations) {
+                    expire_throttles(throttle_resumed);
+                    for (int fd : throttle_resumed) {
+                        if (!reading_parked(sessions[fd])) {
+                            handle_client_data(epoll_fd, fd, sessions[fd]);
+                        }
+                    }
                 }
             } else {
-                handle_client_data(epoll_fd, events[n].data.fd);
+                handle_client_event(epoll_fd, events[n].data.u64, events[n].events);
             }
         }
+        bool served = serve_ready_sessions(epoll_fd);
 
+        if (config.low_latency && (nfds > 0 || served)) {
+            account_work(work_start, stats_clock());
+        }
         if (nfds == static_cast<int>(events.size())) {
             events.resize(events.size() * 2);
         }
     }
 
+    if (throttle_fd != -1) {
+        close(throttle_fd);
+    }
+    if (timer_fd != -1) {
+        close(timer_fd);
+    }
     close(server_fd);
     close(epoll_fd);
     return 0;
 }
 
-int setup_listener_socket(const char* port) {
+int setup_listener_socket(const char* port, bool reuse_port) {
     struct addrinfo hints, *res;
     memset(&hints, 0, sizeof hints);
     hints.ai_family = AF_UNSPEC;
@@ -112,44 +835,42 @@ int setup_listener_socket(const char* port) {
 
     int rv = getaddrinfo(NULL, port, &hints, &res);
     if (rv != 0) {
-        #ifndef NDEBUG
-        std::cout << "getaddrinfo error: " << gai_strerror(rv) << "\n";
-        #endif
+        LOG_ERROR("getaddrinfo error: %s", gai_strerror(rv));
         return -1;
     }
 
-    int listener = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    // Non-blocking so the accept loop can drain the queue until EAGAIN.
+    int listener = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, res->ai_protocol);
     if (listener == -1) {
-        #ifndef NDEBUG
-        std::cout << "Error creating socket: " << strerror(errno) << "\n";
-        #endif
+        LOG_ERROR("Error creating socket: %s", strerror(errno));
         freeaddrinfo(res);
         return -1;
     }
 
     int yes = 1;
     if (setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes) == -1) {
-        #ifndef NDEBUG
-        std::cout << "Error setting socket options: " << strerror(errno) << "\n";
-        #endif
+        LOG_ERROR("Error setting socket options: %s", strerror(errno));
+        freeaddrinfo(res);
+        close(listener);
+        return -1;
+    }
+
+    if (reuse_port && setsockopt(listener, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof yes) == -1) {
+        LOG_ERROR("Error setting SO_REUSEPORT: %s", strerror(errno));
         freeaddrinfo(res);
         close(listener);
         return -1;
     }
 
     if (bind(listener, res->ai_addr, res->ai_addrlen) == -1) {
-        #ifndef NDEBUG
-        std::cout << "Error binding socket: " << strerror(errno) << "\n";
-        #endif
+        LOG_ERROR("Error binding socket: %s", strerror(errno));
         freeaddrinfo(res);
         close(listener);
         return -1;
     }
 
-    if (listen(listener, LISTEN_MAX_CONNECTIONS) == -1) {
-        #ifndef NDEBUG
-        std::cout << "Error listening on socket: " << strerror(errno) << "\n";
-        #endif
+    if (listen(listener, config.backlog) == -1) {
+        LOG_ERROR("Error listening on socket: %s", strerror(errno));
         freeaddrinfo(res);
         close(listener);
         return -1;
@@ -159,188 +880,1630 @@ int setup_listener_socket(const char* port) {
     return listener;
 }
 
-void set_non_blocking(int socket_fd) {
-    int flags = fcntl(socket_fd, F_GETFL, 0);
-    if (flags == -1) {
-        #ifndef NDEBUG
-        std::cout << "Error getting flags for socket: " << strerror(errno) << "\n";
-        #endif
-        return;
-    }
+// Drains the accept queue in one go: the listener is level-triggered, so
+// returning after a single accept would cost an epoll_wait per connection
+// during a reconnect storm.
+int handle_new_connection(int epoll_fd, int server_fd) {
+    while (true) {
+        struct sockaddr_storage their_addr;
+        socklen_t addr_size = sizeof their_addr;
+        int new_fd = accept4(server_fd, (struct sockaddr *)&their_addr, &addr_size, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (new_fd == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE) {
+                if (shed_connection(server_fd)) {
+                    continue;
+                }
+                return 0;
+            }
+            LOG_ERROR("Error accepting new connection: %s", strerror(errno));
+            return -1;
+        }
+
+        if (!admit_connection(new_fd)) {
+            continue;
+        }
+        if (config.low_latency) {
+            tune_low_latency_socket(new_fd);
+        }
+        Session& session = open_session(new_fd);
+        if (config.zerocopy_threshold > 0) {
+            enable_zerocopy(new_fd, *session.connection);
+        }
 
-    if (fcntl(socket_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
-        #ifndef NDEBUG
-        std::cout << "Error setting non-blocking flag for socket: " << strerror(errno) << "\n";
-        #endif
+        struct epoll_event ev;
+        ev.events = EPOLL_FLAGS;
+        ev.data.u64 = session_tag(new_fd, session.generation);
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, new_fd, &ev) == -1) {
+            LOG_ERROR("Error adding new connection to epoll: %s", strerror(errno));
+            close_client_connection(epoll_fd, new_fd);
+            return -1;
+        }
     }
 }
 
-int handle_new_connection(int epoll_fd, int server_fd) {
-    struct sockaddr_storage their_addr;
-    socklen_t addr_size = sizeof their_addr;
-    int new_fd = accept(server_fd, (struct sockaddr *)&their_addr, &addr_size);
-    if (new_fd == -1) {
-        #ifndef NDEBUG
-        std::cout << "Error accepting new connection: " << strerror(errno) << "\n";
-        #endif
-        return -1;
+// Connections over the limit are accepted and closed at once rather than
+// left in the backlog, where they would time out and retry anyway.
+bool admit_connection(int client_fd) {
+    if (config.max_connections > 0 && active_connections.load(std::memory_order_relaxed) >= config.max_connections) {
+        LOG_INFO("Connection limit reached, dropping fd: %d", client_fd);
+        stats_count(StatsCounter::REJECTED);
+        close(client_fd);
+        return false;
     }
+    return true;
+}
 
-    set_non_blocking(new_fd);
+// Out of descriptors: give up the spare so the connection at the head of
+// the queue can be accepted and closed, then take the spare back. Without
+// this the listener stays readable and the reactor spins on EMFILE.
+// accept reports EMFILE before looking at the queue, so returns false once
+// the queue turns out to be empty.
+bool shed_connection(int server_fd) {
+    if (spare_fd >= 0) {
+        close(spare_fd);
+    }
+    int fd = accept(server_fd, nullptr, nullptr);
+    if (fd >= 0) {
+        LOG_WARN("Out of file descriptors, shedding a connection");
+        stats_count(StatsCounter::SHED);
+        close(fd);
+    }
+    spare_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    return fd >= 0;
+}
 
-    struct epoll_event ev;
-    ev.events = EPOLL_FLAGS;
-    ev.data.fd = new_fd;
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, new_fd, &ev) == -1) {
-        #ifndef NDEBUG
-        std::cout << "Error adding new connection to epoll: " << strerror(errno) << "\n";
-        #endif
-        close(new_fd);
-        return -1;
+// Responses go out as soon as they are written instead of waiting on
+// Nagle, and reads busy-poll the device queue for busy_poll_us before
+// sleeping. Raising SO_BUSY_POLL above net.core.busy_read needs
+// CAP_NET_ADMIN, so a failure is only reported once.
+void tune_low_latency_socket(int client_fd) {
+    int one = 1;
+    setsockopt(client_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    if (config.busy_poll_us > 0 &&
+        setsockopt(client_fd, SOL_SOCKET, SO_BUSY_POLL, &config.busy_poll_us, sizeof config.busy_poll_us) == -1) {
+        static std::atomic<bool> warned(false);
+        if (!warned.exchange(true)) {
+            LOG_WARN("Error setting SO_BUSY_POLL: %s", strerror(errno));
+        }
     }
+}
 
-    return 0;
+int spin_timeout(uint64_t now) {
+    return now - spin_idle_since < LOW_LATENCY_IDLE_SPIN_NS ? 0 : -1;
 }
 
-bool receive_header(int client_fd, std::vector<uint8_t>& buffer, Header& header) {
-    int count = recv(client_fd, &buffer[0], HEADER_BYTE_SIZE, 0);
-    if (count == -1 && errno != EAGAIN) {
-        #ifndef NDEBUG
-        std::cout << "Error reading from client: " << strerror(errno) << "\n";
-        #endif
-        return false;
-    } else if (count != HEADER_BYTE_SIZE) {
-        return false;
+// A wait that may block is sleep time, whatever it returned. A
+// non-blocking one is spin time, and so counts toward the cost of the mode
+// even when it found events.
+void account_wait(uint64_t wait_start, uint64_t now, bool blocked) {
+    stats_count(blocked ? StatsCounter::REACTOR_SLEEP_NS : StatsCounter::REACTOR_SPIN_NS, now - wait_start);
+}
+
+void account_work(uint64_t work_start, uint64_t now) {
+    stats_count(StatsCounter::REACTOR_WORK_NS, now - work_start);
+    spin_idle_since = now;
+}
+
+// The buffer pool and the keystream cache keep their own counts; the
+// reactor copies them into its stats before every wait, so a dump is at
+// most one loop pass behind.
+void publish_reactor_stats() {
+    stats_set(StatsCounter::BUFFER_POOL_HITS, buffer_pool.hits());
+    stats_set(StatsCounter::BUFFER_POOL_MISSES, buffer_pool.misses());
+    stats_set(StatsCounter::BUFFER_POOL_BYTES_HELD, buffer_pool.bytes_held());
+    stats_set(StatsCounter::KEYSTREAM_CACHE_HITS, keystream_cache.hits());
+    stats_set(StatsCounter::KEYSTREAM_CACHE_MISSES, keystream_cache.misses());
+}
+
+uint64_t session_tag(int fd, uint32_t generation) {
+    return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+}
+
+// Resets the fd's slot for a new connection, growing the table if needed.
+Session& open_session(int fd) {
+    if (static_cast<size_t>(fd) >= sessions.size()) {
+        size_t size = sessions.empty() ? INITIAL_SESSION_TABLE_SIZE : sessions.size();
+        while (size <= static_cast<size_t>(fd)) {
+            size *= 2;
+        }
+        sessions.resize(size);
     }
 
-    deserialize_header(header, &buffer[0]);
-    if (header.message_size > INITIAL_BUFFER_SIZE) {
-        buffer.resize(header.message_size);
+    Session& session = sessions[fd];
+    uint32_t generation = session.generation + 1;
+    session = Session();
+    session.generation = generation;
+    session.open = true;
+    session.opened_tick = timer_wheel.now();
+    session.active_tick = session.opened_tick;
+    session.connection = slab_new<Connection>();
+    if (capture_enabled()) {
+        session.connection->capture_id = capture_open();
     }
-    return true;
+    if (rate_limits_enabled()) {
+        // Buckets start full: one second's worth of each rate.
+        session.connection->message_tokens = static_cast<double>(config.rate_limit_messages);
+        session.connection->byte_tokens = static_cast<double>(config.rate_limit_bytes);
+        session.connection->tokens_refilled = stats_clock();
+    }
+    uint32_t deadline;
+    if (session_deadline(session, deadline)) {
+        session.connection->timer_deadline = timer_wheel.schedule(deadline, session_tag(fd, generation));
+        session.connection->timer_scheduled = true;
+    }
+    active_connections.fetch_add(1, std::memory_order_relaxed);
+    stats_count(StatsCounter::ACCEPTED);
+    return session;
 }
 
-bool is_valid_request(const Header& header) {
-    if (header.message_type != LOGIN_REQUEST_TYPE && header.message_type != ECHO_REQUEST_TYPE) {
-        #ifndef NDEBUG
-        std::cout << "Invalid request from client.\n";
-        #endif
-        return false;
+Session* find_session(uint64_t tag) {
+    size_t fd = static_cast<uint32_t>(tag);
+    if (fd >= sessions.size()) {
+        return nullptr;
     }
-    return true;
+    Session& session = sessions[fd];
+    if (!session.open || session.generation != static_cast<uint32_t>(tag >> 32)) {
+        return nullptr;
+    }
+    return &session;
 }
 
-bool handle_login_request(int client_fd, const Header& header, std::vector<uint8_t>& buffer) {
-    if (recv(client_fd, &buffer[0], USER_CREDENTIALS_BYTE_SIZE, 0) != USER_CREDENTIALS_BYTE_SIZE) {
-        return false;
+// The table is indexed by fd.
+int session_fd(const Session& session) {
+    return static_cast<int>(&session - sessions.data());
+}
+
+// Makes room for at least size more bytes after write_offset, first by
+// moving the pending partial frame to the front, then by growing the buffer.
+void reserve_receive_buffer(Connection& connection, size_t size) {
+    PooledBuffer& buffer = connection.buffer;
+    if (buffer.data == nullptr) {
+        buffer = buffer_pool.acquire(std::max<size_t>(INITIAL_BUFFER_SIZE, size));
+        return;
+    }
+    if (buffer.capacity - connection.write_offset >= size) {
+        return;
+    }
+
+    size_t pending = connection.write_offset - connection.read_offset;
+    if (buffer.capacity - pending >= size) {
+        memmove(buffer.data, buffer.data + connection.read_offset, pending);
+    } else {
+        size_t capacity = buffer.capacity * 2;
+        while (capacity - pending < size) {
+            capacity *= 2;
+        }
+        PooledBuffer larger = buffer_pool.acquire(capacity);
+        memcpy(larger.data, buffer.data + connection.read_offset, pending);
+        buffer_pool.release(buffer);
+        buffer = larger;
     }
+    connection.read_offset = 0;
+    connection.write_offset = pending;
+}
 
-    UserCredentials userCredentials;
-    deserialize_user_credentials(userCredentials, &buffer[0]);
-    uint16_t status_code = user_login(client_fd, userCredentials);
+// A stream in progress reads in larger chunks, since every byte of it is
+// consumed as soon as it arrives and the buffer never has to hold a frame.
+// The bytes read are added to received.
+bool receive_data(int client_fd, Connection& connection, bool& closed, size_t& received) {
+    reserve_receive_buffer(connection, connection.stream_remaining > 0 ? STREAM_RECEIVE_SIZE : 1);
+    PooledBuffer& buffer = connection.buffer;
 
-    if (status_code == 0) {
-        return false;
+    uint64_t receive_start = stats_clock();
+    ssize_t count = recv(client_fd, buffer.data + connection.write_offset, buffer.capacity - connection.write_offset, 0);
+    if (count > 0) {
+        thread_stats().receive.record(stats_clock() - receive_start);
+        connection.write_offset += count;
+        received += count;
+        return true;
+    }
+
+    if (count == -1 && errno == EINTR) {
+        return true;
+    }
+
+    closed = count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+    if (count == -1 && closed) {
+        LOG_INFO("Error reading from client: %s", strerror(errno));
     }
+    return false;
+}
+
+bool process_frames(Session& session) {
+    Connection& connection = *session.connection;
+    while (true) {
+        uint8_t* frame = connection.buffer.data + connection.read_offset;
+        size_t available = connection.write_offset - connection.read_offset;
+
+        if (session.state == ParseState::HEADER) {
+            if (available < HEADER_BYTE_SIZE) {
+                break;
+            }
+            deserialize_header(session.header, frame);
+            if (!is_valid_request(session.header)) {
+                return false;
+            }
+            if (session.header.message_type == LOGIN_REQUEST_TYPE) {
+                session.frame_size = LOGIN_REQUEST_BYTE_SIZE;
+                session.state = ParseState::BODY;
+            } else if (session.header.message_type == RESUME_REQUEST_TYPE) {
+                session.frame_size = RESUME_REQUEST_BYTE_SIZE;
+                session.state = ParseState::BODY;
+            } else if (session.header.message_type == STATS_REQUEST_TYPE) {
+                session.frame_size = STATS_REQUEST_BYTE_SIZE;
+                session.state = ParseState::BODY;
+            } else if (session.header.message_type == ECHO_BATCH_REQUEST_TYPE) {
+                session.frame_size = session.header.message_size;
+                session.state = ParseState::BODY;
+            } else if (session.header.message_type == ECHO_STREAM_REQUEST_TYPE) {
+                session.frame_size = ECHO_STREAM_HEADER_BYTE_SIZE;
+                session.state = ParseState::BODY;
+            } else {
+                session.state = ParseState::SIZE;
+            }
+        } else if (session.state == ParseState::SIZE) {
+            if (available < HEADER_BYTE_SIZE + SIZE_BYTE_SIZE) {
+                break;
+            }
+            uint16_t message_size = ntohs(frame[HEADER_BYTE_SIZE] | (frame[HEADER_BYTE_SIZE + 1] << 8));
+            session.frame_size = HEADER_BYTE_SIZE + SIZE_BYTE_SIZE + message_size;
+            session.state = ParseState::BODY;
+        } else if (session.state == ParseState::LOGIN) {
+            break;
+        } else if (session.state == ParseState::STREAM) {
+            if (available == 0) {
+                break;
+            }
+            size_t chunk = std::min<size_t>(available, connection.stream_remaining);
+            connection.read_offset += chunk;
+            if (rate_limits_enabled()) {
+                charge_rate_limits(connection, 0, chunk);
+            }
+            handle_echo_stream_chunk(session, frame, chunk);
+        } else {
+            if (available < session.frame_size) {
+                break;
+            }
+            connection.read_offset += session.frame_size;
+            session.state = ParseState::HEADER;
+            session.active_tick = timer_wheel.now();
+            ++session.messages;
+            session.bytes_received += session.frame_size;
+            stats_count(StatsCounter::BYTES_RECEIVED, session.frame_size);
+            if (connection.capture_id != 0) {
+                capture_request(session, frame);
+            }
+            if (rate_limits_enabled()) {
+                uint16_t messages = 1;
+                if (session.header.message_type == ECHO_BATCH_REQUEST_TYPE) {
+                    deserialize_echo_batch_count(messages, frame + HEADER_BYTE_SIZE);
+                }
+                charge_rate_limits(connection, messages, session.frame_size);
+            }
 
-    LoginResponse response = {{LOGIN_RESPONSE_BYTE_SIZE, LOGIN_RESPONSE_TYPE, header.message_sequence}, status_code};
-    #ifndef NDEBUG
-    print_login_response(response);
-    #endif
-    serialize_login_response(response, &buffer[0]);
+            bool handled;
+            if (session.header.message_type == LOGIN_REQUEST_TYPE) {
+                handled = handle_login_request(session, frame);
+            } else if (session.header.message_type == RESUME_REQUEST_TYPE) {
+                handled = handle_resume_request(session, frame);
+            } else if (session.header.message_type == STATS_REQUEST_TYPE) {
+                handled = handle_stats_request(session, frame);
+            } else if (session.header.message_type == ECHO_BATCH_REQUEST_TYPE) {
+                handled = handle_echo_batch_request(session, frame);
+            } else if (session.header.message_type == ECHO_STREAM_REQUEST_TYPE) {
+                handled = handle_echo_stream_request(session, frame);
+            } else {
+                handled = handle_echo_request(session, frame);
+            }
+            if (!handled) {
+                return false;
+            }
+        }
+    }
 
-    return send_response(client_fd, buffer, response.header.message_size);
+    if (connection.read_offset == connection.write_offset) {
+        connection.read_offset = 0;
+        connection.write_offset = 0;
+    }
+    return true;
 }
 
-bool handle_echo_request(int client_fd, const Header& header, std::vector<uint8_t>& buffer) {
-    auto it = logged_users.find(client_fd);
-    if (it == logged_users.end()) {
-        return false;
+// Records the frame before its handler writes the response over it. A
+// batch's message count is taken as sent; the handler validates it.
+void capture_request(const Session& session, const uint8_t* frame) {
+    uint32_t size = session.frame_size;
+    uint16_t count = 1;
+    if (session.header.message_type == ECHO_STREAM_REQUEST_TYPE) {
+        EchoStreamHeader request;
+        deserialize_echo_stream_header(request, frame);
+        size = request.message_size;
+    } else if (session.header.message_type == ECHO_BATCH_REQUEST_TYPE) {
+        deserialize_echo_batch_count(count, frame + HEADER_BYTE_SIZE);
     }
+    capture_frame(session.connection->capture_id, session.header, size, count);
+}
 
-    if (recv(client_fd, &buffer[0], SIZE_BYTE_SIZE, 0) != SIZE_BYTE_SIZE) {
+bool is_valid_request(const Header& header) {
+    if (header.message_type != LOGIN_REQUEST_TYPE && header.message_type != ECHO_REQUEST_TYPE &&
+        header.message_type != STATS_REQUEST_TYPE && header.message_type != ECHO_BATCH_REQUEST_TYPE &&
+        header.message_type != ECHO_STREAM_REQUEST_TYPE &&
+        (header.message_type != RESUME_REQUEST_TYPE || config.ticket_lifetime == 0)) {
+        LOG_INFO("Invalid request from client, message type: %d", header.message_type);
+        stats_count(StatsCounter::PROTOCOL_ERRORS);
         return false;
     }
-
-    uint16_t cipher_message_size = ntohs(buffer[0] | (buffer[1] << 8));
-    if (recv(client_fd, &buffer[0], cipher_message_size, 0) != cipher_message_size) {
+    if (header.message_type == ECHO_BATCH_REQUEST_TYPE && header.message_size < ECHO_BATCH_HEADER_BYTE_SIZE) {
+        LOG_INFO("Invalid batch request from client, frame size: %d", header.message_size);
+        stats_count(StatsCounter::PROTOCOL_ERRORS);
         return false;
     }
+    return true;
+}
+
+// Checking the credentials may be slow, so it is left to the login workers
+// and the connection parks until their verdict comes back. When too many
+// logins are already waiting the request is answered BUSY at once, written
+// over the request frame like the echo responses.
+bool handle_login_request(Session& session, uint8_t* frame) {
+    LoginRequest request;
+    deserialize_login_request(request, frame);
 
-    std::string cipher_message(buffer.begin(), buffer.begin() + cipher_message_size);
-    #ifndef NDEBUG
-    std::cout << "Cipher message: " << cipher_message << std::endl;
-    #endif
-    std::string plain_message = decrypt_echo_message(it->second, header.message_sequence, cipher_message);
+    LoginJob login = {session_tag(session_fd(session), session.generation), request.credentials, LOGIN_STATUS_FAILED};
+    if (submit_login(login_inbox, login)) {
+        session.state = ParseState::LOGIN;
+        return true;
+    }
 
-    EchoResponse response = {{static_cast<uint16_t>(HEADER_BYTE_SIZE + SIZE_BYTE_SIZE + cipher_message_size), ECHO_RESPONSE_TYPE, header.message_sequence}, cipher_message_size, plain_message};
-    #ifndef NDEBUG
-    print_echo_response(response);
-    #endif
+    stats_count(StatsCounter::LOGINS_REJECTED);
+    LoginResponse response = {{LOGIN_RESPONSE_BYTE_SIZE, LOGIN_RESPONSE_TYPE, request.header.message_sequence}, LOGIN_STATUS_BUSY};
+    LOG_DEBUG("Login response: sequence %d, status %d", response.header.message_sequence, response.status_code);
+    uint8_t* end = serialize_login_response(response, frame);
 
-    serialize_echo_response(response, &buffer[0]);
-    return send_response(client_fd, buffer, response.header.message_size);
+    stage_response(*session.connection, frame, end - frame);
+    return true;
 }
 
-bool send_response(int client_fd, const std::vector<uint8_t>& buffer, int response_size) {
-    if (send(client_fd, &buffer[0], response_size, 0) == -1) {
-        #ifndef NDEBUG
-        std::cout << "Error sending data to client: " << strerror(errno) << "\n";
-        #endif
+// Applies a verdict from the login workers to its parked session, which
+// still holds the login's header. The request frame may be gone from the
+// receive buffer by now, so the response is queued as owned output. Returns
+// false if the login failed and the connection is to be closed.
+bool finish_login(Session& session, const LoginJob& login) {
+    session.state = ParseState::HEADER;
+    if (login.status_code != LOGIN_STATUS_OK) {
+        stats_count(StatsCounter::LOGIN_FAILURES);
         return false;
     }
+    stats_count(StatsCounter::LOGINS);
+    if (!session.logged_in) {
+        session.key = derive_echo_key(login.credentials);
+        session.logged_in = true;
+    }
+
+    uint8_t buffer[LOGIN_RESPONSE_TICKET_BYTE_SIZE];
+    size_t size = serialize_login_success(session, LOGIN_RESPONSE_TYPE, buffer);
+    append_output(*session.connection, buffer, size);
     return true;
 }
 
-
-void handle_client_data(int epoll_fd, int client_fd) {
-    std::vector<uint8_t> buffer(INITIAL_BUFFER_SIZE);
-    Header header;
-    if (!receive_header(client_fd, buffer, header)) {
-        close_client_connection(epoll_fd, client_fd);
-        return;
+// The OK answer to a login or resume, with a ticket for the session's key
+// when tickets are enabled. Returns the size of the response.
+size_t serialize_login_success(const Session& session, uint8_t type, uint8_t* buffer) {
+    uint16_t size = config.ticket_lifetime > 0 ? LOGIN_RESPONSE_TICKET_BYTE_SIZE : LOGIN_RESPONSE_BYTE_SIZE;
+    LoginResponse response = {{size, type, session.header.message_sequence}, LOGIN_STATUS_OK};
+    LOG_DEBUG("Login response: type %d, sequence %d, %d bytes", type, response.header.message_sequence, size);
+    uint8_t* ticket = serialize_login_response(response, buffer);
+    if (config.ticket_lifetime > 0) {
+        seal_ticket(session.key, static_cast<uint64_t>(time(nullptr)) + config.ticket_lifetime, ticket);
     }
+    return size;
+}
 
-    if (!is_valid_request(header)) {
-        close_client_connection(epoll_fd, client_fd);
-        return;
-    }
+// Opening a ticket is a couple of HMACs, cheap enough to do on the reactor,
+// so unlike a login it does not park the connection: echoes pipelined
+// behind it are answered in the same pass. A ticket that does not open
+// closes the connection like a failed login.
+bool handle_resume_request(Session& session, uint8_t* frame) {
+    ResumeRequest request;
+    deserialize_resume_request(request, frame);
 
-    if (header.message_type == LOGIN_REQUEST_TYPE) {
-        if (!handle_login_request(client_fd, header, buffer)) {
-            close_client_connection(epoll_fd, client_fd);
-        }
-    } else {
-        if (!handle_echo_request(client_fd, header, buffer)) {
-            close_client_connection(epoll_fd, client_fd);
-        }
+    EchoKey key;
+    if (!open_ticket(request.ticket.bytes, static_cast<uint64_t>(time(nullptr)), key)) {
+        LOG_INFO("Invalid or expired resumption ticket");
+        stats_count(StatsCounter::RESUMPTION_FAILURES);
+        return false;
     }
+    stats_count(StatsCounter::RESUMPTIONS);
+    if (!session.logged_in) {
+        session.key = key;
+        session.logged_in = true;
+    }
+
+    uint8_t buffer[LOGIN_RESPONSE_TICKET_BYTE_SIZE];
+    size_t size = serialize_login_success(session, RESUME_RESPONSE_TYPE, buffer);
+    spill_staged(*session.connection);
+    append_output(*session.connection, buffer, size);
+    return true;
 }
 
+bool reading_parked(const Session& session) {
+    return session.reading_paused || session.throttled || session.state == ParseState::LOGIN;
+}
 
-void close_client_connection(int epoll_fd, int client_fd) {
-    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, NULL) == -1) {
-        #ifndef NDEBUG
-        std::cout << "Error removing client fd from epoll: " << strerror(errno) << "\n";
-        #endif
+bool handle_echo_request(Session& session, uint8_t* frame) {
+    if (!session.logged_in) {
+        stats_count(StatsCounter::PROTOCOL_ERRORS);
+        return false;
     }
 
-    auto it = logged_users.find(client_fd);
-    if (it != logged_users.end()) {
-        logged_users.erase(it);
-        #ifndef NDEBUG
-        std::cout << "Logged user removed, fd: " << client_fd << std::endl;
-        #endif
-    }
+    EchoRequestView request;
+    deserialize_echo_request(request, frame);
+    LOG_DEBUG("Echo request: sequence %d, %d bytes", request.header.message_sequence, request.message_size);
 
-    close(client_fd);
-    #ifndef NDEBUG
-    std::cout << "Connection closed, fd: " << client_fd << std::endl;
-    #endif
-}
+    uint8_t* message = frame + HEADER_BYTE_SIZE + SIZE_BYTE_SIZE;
+    uint32_t seed = echo_cipher_seed(session.key, request.header.message_sequence);
+    uint64_t decrypt_start = stats_clock();
+    keystream_cache.apply(seed, message, message, request.message_size);
+    ThreadStats& stats = thread_stats();
+    stats.decrypt.record(stats_clock() - decrypt_start);
+    stats_add(stats.counters[static_cast<size_t>(StatsCounter::ECHO_MESSAGES)], 1);
 
-uint16_t user_login(int client_fd, const UserCredentials &user_credentials){
-    logged_users.insert({client_fd, user_credentials});
+    EchoResponseView response = {{static_cast<uint16_t>(HEADER_BYTE_SIZE + SIZE_BYTE_SIZE + request.message_size), ECHO_RESPONSE_TYPE, request.header.message_sequence}, request.message_size, request.cipher_message};
+    LOG_DEBUG("Echo response: sequence %d, message: %.*s", response.header.message_sequence,
+              static_cast<int>(response.plain_message.size()), response.plain_message.data());
+    uint8_t* end = serialize_echo_response(response, frame);
 
-    return 1;
+    stage_response(*session.connection, frame, end - frame);
+    return true;
+}
+
+// Every payload is decrypted in place in one pass over the frame, after
+// which only the message type in the header changes. The entries must fill
+// the frame exactly.
+bool handle_echo_batch_request(Session& session, uint8_t* frame) {
+    if (!session.logged_in) {
+        stats_count(StatsCounter::PROTOCOL_ERRORS);
+        return false;
+    }
+
+    const uint8_t* frame_end = frame + session.header.message_size;
+    uint16_t count;
+    size_t offset = deserialize_echo_batch_count(count, frame + HEADER_BYTE_SIZE) - frame;
+    uint64_t decrypt_start = stats_clock();
+    for (uint16_t i = 0; i < count; ++i) {
+        if (session.header.message_size - offset < ECHO_BATCH_ENTRY_HEADER_BYTE_SIZE) {
+            offset = SIZE_MAX;
+            break;
+        }
+        EchoBatchEntryView message;
+        const uint8_t* next = deserialize_echo_batch_entry(message, frame + offset);
+        if (next > frame_end) {
+            offset = SIZE_MAX;
+            break;
+        }
+        uint8_t* payload = frame + offset + ECHO_BATCH_ENTRY_HEADER_BYTE_SIZE;
+        keystream_cache.apply(echo_cipher_seed(session.key, message.message_sequence), payload, payload, message.message_size);
+        offset = next - frame;
+    }
+    if (offset != session.header.message_size) {
+        LOG_INFO("Malformed batch request from client, %d messages in %d bytes", count, session.header.message_size);
+        stats_count(StatsCounter::PROTOCOL_ERRORS);
+        return false;
+    }
+    ThreadStats& stats = thread_stats();
+    stats.decrypt.record(stats_clock() - decrypt_start);
+    stats_add(stats.counters[static_cast<size_t>(StatsCounter::ECHO_MESSAGES)], count);
+    stats_add(stats.counters[static_cast<size_t>(StatsCounter::ECHO_BATCHES)], 1);
+
+    Header header = {session.header.message_size, ECHO_BATCH_RESPONSE_TYPE, session.header.message_sequence};
+    serialize_header(header, frame);
+    LOG_DEBUG("Echo batch response: sequence %d, %d messages", header.message_sequence, count);
+
+    stage_response(*session.connection, frame, header.message_size);
+    return true;
+}
+
+// The response's stream header is written over the request's, and the
+// payload then follows chunk by chunk as it arrives.
+bool handle_echo_stream_request(Session& session, uint8_t* frame) {
+    if (!session.logged_in) {
+        stats_count(StatsCounter::PROTOCOL_ERRORS);
+        return false;
+    }
+
+    EchoStreamHeader request;
+    deserialize_echo_stream_header(request, frame);
+    stats_count(StatsCounter::ECHO_MESSAGES);
+
+    Connection& connection = *session.connection;
+    connection.stream_remaining = request.message_size;
+    connection.stream_key = echo_cipher_seed(session.key, request.header.message_sequence);
+    if (connection.stream_remaining > 0) {
+        session.state = ParseState::STREAM;
+    }
+    LOG_DEBUG("Echo stream request: sequence %d, %u bytes", request.header.message_sequence, request.message_size);
+
+    EchoStreamHeader response = {{ECHO_STREAM_HEADER_BYTE_SIZE, ECHO_STREAM_RESPONSE_TYPE, request.header.message_sequence}, request.message_size};
+    uint8_t* end = serialize_echo_stream_header(response, frame);
+
+    stage_response(connection, frame, end - frame);
+    return true;
+}
+
+// Decrypts a chunk of the stream in place and stages it, carrying the
+// keystream state over to the next chunk. Only the chunk, never the whole
+// stream, is held, and output backpressure applies to it as to any other
+// response.
+void handle_echo_stream_chunk(Session& session, uint8_t* chunk, size_t size) {
+    Connection& connection = *session.connection;
+    uint64_t decrypt_start = stats_clock();
+    apply_echo_cipher_stream(connection.stream_key, chunk, chunk, size);
+    thread_stats().decrypt.record(stats_clock() - decrypt_start);
+
+    connection.stream_remaining -= size;
+    if (connection.stream_remaining == 0) {
+        session.state = ParseState::HEADER;
+    }
+    session.active_tick = timer_wheel.now();
+    session.bytes_received += size;
+    stats_count(StatsCounter::BYTES_RECEIVED, size);
+
+    stage_response(connection, chunk, size);
+}
+
+// The response is larger than the request, so unlike login and echo it
+// cannot be built in place. Staged responses are spilled into the output
+// queue first so that it still goes out after them.
+bool handle_stats_request(Session& session, uint8_t* frame) {
+    Header header;
+    deserialize_header(header, frame);
+    stats_count(StatsCounter::STATS_REQUESTS);
+
+    StatsResponse response;
+    response.text = format_stats(active_connections.load(std::memory_order_relaxed));
+    if (response.text.size() > MAX_STATS_TEXT_SIZE) {
+        response.text.resize(MAX_STATS_TEXT_SIZE);
+    }
+    response.message_size = static_cast<uint16_t>(response.text.size());
+    response.header = {static_cast<uint16_t>(HEADER_BYTE_SIZE + SIZE_BYTE_SIZE + response.message_size), STATS_RESPONSE_TYPE, header.message_sequence};
+
+    std::vector<uint8_t> buffer(response.header.message_size);
+    serialize_stats_response(response, buffer.data());
+    spill_staged(*session.connection);
+    append_output(*session.connection, buffer.data(), buffer.size());
+    return true;
+}
+
+void stage_response(Connection& connection, const uint8_t* response, size_t response_size) {
+    connection.staged.push_back({const_cast<uint8_t*>(response), response_size});
+    connection.staged_bytes += response_size;
+}
+
+void append_output(Connection& connection, const uint8_t* data, size_t size) {
+    PooledBuffer& output = connection.output;
+    size_t needed = connection.output_bytes + size;
+    if (connection.output_offset + needed > output.capacity) {
+        if (needed <= output.capacity) {
+            memmove(output.data, output.data + connection.output_offset, connection.output_bytes);
+        } else {
+            PooledBuffer larger = buffer_pool.acquire(needed);
+            if (connection.output_bytes > 0) {
+                memcpy(larger.data, output.data + connection.output_offset, connection.output_bytes);
+            }
+            buffer_pool.release(output);
+            output = larger;
+        }
+        connection.output_offset = 0;
+    }
+
+    memcpy(output.data + connection.output_offset + connection.output_bytes, data, size);
+    connection.output_bytes += size;
+}
+
+void consume_output(Connection& connection, size_t count) {
+    size_t owned = std::min(count, connection.output_bytes);
+    connection.output_offset += owned;
+    connection.output_bytes -= owned;
+    count -= owned;
+    if (connection.output_bytes == 0 && connection.output.data != nullptr) {
+        buffer_pool.release(connection.output);
+        connection.output_offset = 0;
+    }
+
+    while (count > 0) {
+        struct iovec& view = connection.staged[connection.staged_head];
+        if (count < view.iov_len) {
+            view.iov_base = static_cast<uint8_t*>(view.iov_base) + count;
+            view.iov_len -= count;
+            connection.staged_bytes -= count;
+            return;
+        }
+        count -= view.iov_len;
+        connection.staged_bytes -= view.iov_len;
+        ++connection.staged_head;
+    }
+}
+
+// Copies staged responses that are still unsent into the owned output
+// buffer, so the receive buffer they point into can be reused.
+void spill_staged(Connection& connection) {
+    for (size_t i = connection.staged_head; i < connection.staged.size(); ++i) {
+        append_output(connection, static_cast<const uint8_t*>(connection.staged[i].iov_base), connection.staged[i].iov_len);
+    }
+    connection.staged.clear();
+    connection.staged_head = 0;
+    connection.staged_bytes = 0;
+}
+
+// Writes as much of the output queue and the staged responses as the socket
+// accepts, then keeps EPOLLOUT registered only while data is still pending.
+// Staged responses that were not sent are copied out, since they point into
+// the receive buffer that the next read reuses.
+//
+// Large flushes that are all staged views go out with MSG_ZEROCOPY instead,
+// which pins the receive buffer until the kernel is done with it. If the
+// kernel is short of memory to track another zero-copy send, the flush
+// falls back to copying.
+bool flush_output(int epoll_fd, int client_fd, Session& session) {
+    Connection& connection = *session.connection;
+    bool zerocopy = connection.zerocopy;
+    bool pinned = false;
+    while (connection.output_bytes + connection.staged_bytes > 0) {
+        struct iovec iov[MAX_IOVECS];
+        int iov_count = 0;
+        if (connection.output_bytes > 0) {
+            iov[iov_count].iov_base = connection.output.data + connection.output_offset;
+            iov[iov_count].iov_len = connection.output_bytes;
+            ++iov_count;
+        }
+        for (size_t i = connection.staged_head; i < connection.staged.size() && iov_count < MAX_IOVECS; ++i) {
+            iov[iov_count++] = connection.staged[i];
+        }
+
+        bool send_zerocopy = zerocopy && connection.output_bytes == 0 && connection.staged_bytes >= config.zerocopy_threshold;
+        uint64_t send_start = stats_clock();
+        ssize_t count;
+        if (send_zerocopy) {
+            struct msghdr message = {};
+            message.msg_iov = iov;
+            message.msg_iovlen = iov_count;
+            count = sendmsg(client_fd, &message, MSG_ZEROCOPY);
+        } else {
+            count = writev(client_fd, iov, iov_count);
+        }
+        thread_stats().send.record(stats_clock() - send_start);
+        if (count == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (send_zerocopy && errno == ENOBUFS) {
+                zerocopy = false;
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            LOG_INFO("Error sending data to client: %s", strerror(errno));
+            return false;
+        }
+        if (send_zerocopy) {
+            pin_receive_buffer(connection, count, pinned);
+            pinned = true;
+            stats_count(StatsCounter::BYTES_SENT_ZEROCOPY, count);
+        }
+        consume_output(connection, count);
+        session.active_tick = timer_wheel.now();
+        session.bytes_sent += count;
+        stats_count(StatsCounter::BYTES_SENT, count);
+    }
+
+    spill_staged(connection);
+
+    uint32_t events = connection.output_bytes > 0 ? EPOLL_FLAGS | EPOLLOUT : EPOLL_FLAGS;
+    if (events != session.events) {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.u64 = session_tag(client_fd, session.generation);
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client_fd, &ev) == -1) {
+            LOG_ERROR("Error updating client fd in epoll: %s", strerror(errno));
+            return false;
+        }
+        session.events = events;
+    }
+    return true;
+}
+
+// Zero-copy needs the wheel too, for the grace period of deferred closes.
+bool timeouts_enabled() {
+    return config.idle_timeout > 0 || config.login_timeout > 0 || config.zerocopy_threshold > 0;
+}
+
+// Periodic timerfd that drives the reactor's timer wheel, one tick every
+// TIMER_TICK_MS. Reading it yields the number of ticks since the last read,
+// so a reactor held up by a long batch catches up in one go.
+int open_tick_timer() {
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer_fd == -1) {
+        return -1;
+    }
+    struct itimerspec interval;
+    interval.it_interval.tv_sec = TIMER_TICK_MS / 1000;
+    interval.it_interval.tv_nsec = (TIMER_TICK_MS % 1000) * 1000000L;
+    interval.it_value = interval.it_interval;
+    if (timerfd_settime(timer_fd, 0, &interval, nullptr) == -1) {
+        close(timer_fd);
+        return -1;
+    }
+    return timer_fd;
+}
+
+bool rate_limits_enabled() {
+    return config.rate_limit_messages > 0 || config.rate_limit_bytes > 0;
+}
+
+void charge_rate_limits(Connection& connection, uint32_t messages, uint64_t bytes) {
+    connection.message_tokens -= messages;
+    connection.byte_tokens -= bytes;
+}
+
+// Refills the buckets for the time since they were last checked, up to one
+// second's worth, and throttles the session if either of them cannot pay
+// for another message or byte. It then stays throttled until the deeper
+// one has refilled that far, however much input is waiting.
+void enforce_rate_limits(Session& session, int client_fd) {
+    Connection& connection = *session.connection;
+    uint64_t now = stats_clock();
+    double elapsed = static_cast<double>(now - connection.tokens_refilled) / 1e9;
+    connection.tokens_refilled = now;
+
+    double wait = 0;
+    if (config.rate_limit_messages > 0) {
+        double rate = static_cast<double>(config.rate_limit_messages);
+        connection.message_tokens = std::min(rate, connection.message_tokens + elapsed * rate);
+        wait = std::max(wait, (1 - connection.message_tokens) / rate);
+    }
+    if (config.rate_limit_bytes > 0) {
+        double rate = static_cast<double>(config.rate_limit_bytes);
+        connection.byte_tokens = std::min(rate, connection.byte_tokens + elapsed * rate);
+        wait = std::max(wait, (1 - connection.byte_tokens) / rate);
+    }
+    if (wait <= 0) {
+        return;
+    }
+
+    session.throttled = true;
+    stats_count(StatsCounter::RATE_LIMITED);
+    uint64_t due = now + static_cast<uint64_t>(wait * 1e9) + 1;
+    throttle_queue.emplace_back(due, session_tag(client_fd, session.generation));
+    std::push_heap(throttle_queue.begin(), throttle_queue.end(), std::greater<>());
+    if (throttle_armed == 0 || due < throttle_armed) {
+        arm_throttle_timer(due);
+    }
+}
+
+void arm_throttle_timer(uint64_t due) {
+    struct itimerspec when;
+    memset(&when, 0, sizeof when);
+    when.it_value.tv_sec = static_cast<time_t>(due / 1000000000);
+    when.it_value.tv_nsec = static_cast<long>(due % 1000000000);
+    if (timerfd_settime(throttle_fd, TFD_TIMER_ABSTIME, &when, nullptr) == -1) {
+        LOG_ERROR("Error arming the throttle timer: %s", strerror(errno));
+    }
+    throttle_armed = due;
+}
+
+// Lifts every throttle that has run out and re-arms the timer for the next
+// one. The fds of the sessions lifted are left in resumed; a session closed
+// while throttled is skipped, as its tag no longer matches, and so is one
+// still closing, which must not be read from again.
+void expire_throttles(std::vector<int>& resumed) {
+    resumed.clear();
+    throttle_armed = 0;
+    uint64_t now = stats_clock();
+    while (!throttle_queue.empty() && throttle_queue.front().first <= now) {
+        uint64_t tag = throttle_queue.front().second;
+        std::pop_heap(throttle_queue.begin(), throttle_queue.end(), std::greater<>());
+        throttle_queue.pop_back();
+        Session* session = find_session(tag);
+        if (session != nullptr && session->throttled) {
+            session->throttled = false;
+            if (!session->connection->closing) {
+                resumed.push_back(session_fd(*session));
+            }
+        }
+    }
+    if (!throttle_queue.empty()) {
+        arm_throttle_timer(throttle_queue.front().first);
+    }
+}
+
+// Tick at which the session times out: idle_timeout after it was last
+// active, or login_timeout after it connected if it has not logged in yet,
+// whichever comes first. Returns false if no timeout applies to it.
+bool session_deadline(const Session& session, uint32_t& deadline) {
+    bool limited = false;
+    if (config.idle_timeout > 0) {
+        deadline = session.active_tick + config.idle_timeout;
+        limited = true;
+    }
+    if (config.login_timeout > 0 && !session.logged_in) {
+        uint32_t login_deadline = session.opened_tick + config.login_timeout;
+        if (!limited || static_cast<int32_t>(login_deadline - deadline) < 0) {
+            deadline = login_deadline;
+        }
+        limited = true;
+    }
+    return limited;
+}
+
+// Advances the wheel and collects the fds of sessions that are past their
+// deadline. Sessions that were active since their entry was scheduled get a
+// new entry for their current deadline; entries of sessions no timeout
+// applies to any more are dropped. Closed sessions took their entry out
+// when they were released, and a session whose close is still waiting
+// comes due when its grace period is over. Closing is left to the caller,
+// which knows the backend.
+void expire_sessions(uint64_t ticks, std::vector<int>& expired) {
+    expired.clear();
+    timer_due.clear();
+    timer_wheel.advance(ticks, timer_due);
+    for (uint64_t tag : timer_due) {
+        Session* session = find_session(tag);
+        if (session == nullptr) {
+            continue;
+        }
+        Connection& connection = *session->connection;
+        connection.timer_scheduled = false;
+        if (connection.closing) {
+            expired.push_back(static_cast<int>(static_cast<uint32_t>(tag)));
+            continue;
+        }
+        uint32_t deadline;
+        if (!session_deadline(*session, deadline)) {
+            continue;
+        }
+        if (static_cast<int32_t>(deadline - timer_wheel.now()) > 0) {
+            connection.timer_deadline = timer_wheel.schedule(deadline, tag);
+            connection.timer_scheduled = true;
+            continue;
+        }
+        int fd = static_cast<int>(static_cast<uint32_t>(tag));
+        LOG_INFO("%s, fd: %d", session->logged_in ? "Idle connection timed out" : "Login deadline missed", fd);
+        stats_count(StatsCounter::TIMED_OUT);
+        expired.push_back(fd);
+    }
+}
+
+
+// SO_ZEROCOPY only allows MSG_ZEROCOPY on the socket; whether a send uses
+// it is decided per flush. Kernels without it just keep copying.
+void enable_zerocopy(int client_fd, Connection& connection) {
+    int enable = 1;
+    if (setsockopt(client_fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof enable) == -1) {
+        LOG_DEBUG("SO_ZEROCOPY unavailable on fd %d: %s", client_fd, strerror(errno));
+        return;
+    }
+    connection.zerocopy = true;
+}
+
+// Sets the receive buffer aside for a zero-copy send of bytes, or, when
+// extend is set, records a further send from the buffer pinned last. A
+// partial frame still in the buffer is carried over to a fresh one.
+void pin_receive_buffer(Connection& connection, size_t bytes, bool extend) {
+    uint32_t send_id = connection.zerocopy_next_id++;
+    if (extend) {
+        ZeroCopyPin& pin = connection.zerocopy_pinned.back();
+        pin.last_send_id = send_id;
+        pin.bytes += bytes;
+        return;
+    }
+
+    PooledBuffer pinned = connection.buffer;
+    connection.zerocopy_pinned.push_back({pinned, send_id, bytes});
+    connection.buffer = PooledBuffer();
+    size_t pending = connection.write_offset - connection.read_offset;
+    if (pending > 0) {
+        reserve_receive_buffer(connection, pending);
+        memcpy(connection.buffer.data, pinned.data + connection.read_offset, pending);
+    }
+    connection.read_offset = 0;
+    connection.write_offset = pending;
+}
+
+// Drains the socket's error queue. Each zero-copy notification reports a
+// range of send ids as complete; TCP completes them in order, so every pin
+// up to the end of the range can go back to the pool.
+void reap_zerocopy_completions(int client_fd, Connection& connection) {
+    while (connection.zerocopy_head < connection.zerocopy_pinned.size()) {
+        char control[128];
+        struct msghdr message = {};
+        message.msg_control = control;
+        message.msg_controllen = sizeof control;
+        if (recvmsg(client_fd, &message, MSG_ERRQUEUE) == -1) {
+            break;
+        }
+
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg)) {
+            bool ip_error = (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                            (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR);
+            if (!ip_error) {
+                continue;
+            }
+            const struct sock_extended_err* error = reinterpret_cast<const struct sock_extended_err*>(CMSG_DATA(cmsg));
+            if (error->ee_origin == SO_EE_ORIGIN_ZEROCOPY && error->ee_errno == 0) {
+                release_zerocopy_pins(connection, error->ee_data, error->ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+            }
+        }
+    }
+}
+
+// copied means the kernel fell back to copying the data after all, as it
+// does on loopback; those bytes are counted separately.
+void release_zerocopy_pins(Connection& connection, uint32_t last_send_id, bool copied) {
+    while (connection.zerocopy_head < connection.zerocopy_pinned.size()) {
+        ZeroCopyPin& pin = connection.zerocopy_pinned[connection.zerocopy_head];
+        if (static_cast<int32_t>(pin.last_send_id - last_send_id) > 0) {
+            break;
+        }
+        if (copied) {
+            stats_count(StatsCounter::BYTES_ZEROCOPY_COPIED, pin.bytes);
+        }
+        buffer_pool.release(pin.buffer);
+        ++connection.zerocopy_head;
+    }
+    if (connection.zerocopy_head == connection.zerocopy_pinned.size()) {
+        connection.zerocopy_pinned.clear();
+        connection.zerocopy_head = 0;
+    }
+}
+
+// Events whose generation no longer matches the fd's session belong to a
+// connection that was closed earlier in the same epoll_wait batch.
+void handle_client_event(int epoll_fd, uint64_t tag, uint32_t events) {
+    Session* session = find_session(tag);
+    if (session == nullptr) {
+        return;
+    }
+
+    int client_fd = static_cast<int>(static_cast<uint32_t>(tag));
+    Connection& connection = *session->connection;
+    if ((events & EPOLLERR) && connection.zerocopy_head < connection.zerocopy_pinned.size()) {
+        reap_zerocopy_completions(client_fd, connection);
+    }
+    if (connection.closing) {
+        if (connection.zerocopy_head == connection.zerocopy_pinned.size()) {
+            close_client_connection(epoll_fd, client_fd);
+        }
+        return;
+    }
+    if (events & EPOLLOUT) {
+        handle_client_writable(epoll_fd, client_fd, *session);
+    }
+    if ((events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && session->open) {
+        handle_client_data(epoll_fd, client_fd, *session);
+    }
+}
+
+// The socket is edge-triggered, so keep reading until EAGAIN and parse every
+// complete frame as it arrives; partial frames stay buffered for next time.
+// A connection that reads config.read_budget bytes first stops there and
+// goes on the ready list, so one pipelining client cannot hold up the
+// rest of the reactor's connections. It is read again from the list in a
+// later pass, and until then its events only flush output.
+void handle_client_data(int epoll_fd, int client_fd, Session& session) {
+    Connection& connection = *session.connection;
+    if (connection.ready_queued) {
+        return;
+    }
+
+    bool closed = false;
+    bool yielded = false;
+    size_t received = 0;
+    while (true) {
+        // Responses staged by process_frames live in the receive buffer, so
+        // they are flushed before the next recv can overwrite them.
+        while (!reading_parked(session) && receive_data(client_fd, connection, closed, received)) {
+            if (!process_frames(session) || !flush_output(epoll_fd, client_fd, session)) {
+                close_client_connection(epoll_fd, client_fd);
+                return;
+            }
+            if (connection.output_bytes >= OUTPUT_HIGH_WATER_MARK) {
+                session.reading_paused = true;
+            }
+            if (rate_limits_enabled()) {
+                enforce_rate_limits(session, client_fd);
+            }
+            if (config.read_budget > 0 && received >= config.read_budget) {
+                yielded = true;
+                break;
+            }
+        }
+
+        if (!flush_output(epoll_fd, client_fd, session)) {
+            close_client_connection(epoll_fd, client_fd);
+            return;
+        }
+
+        if (closed || !session.reading_paused || connection.output_bytes > OUTPUT_LOW_WATER_MARK) {
+            break;
+        }
+        session.reading_paused = false;
+        if (yielded) {
+            break;
+        }
+    }
+
+    if (closed) {
+        close_client_connection(epoll_fd, client_fd);
+        return;
+    }
+    if (yielded && !reading_parked(session)) {
+        connection.ready_queued = true;
+        ready_sessions.push_back(session_tag(client_fd, session.generation));
+        stats_count(StatsCounter::READ_BUDGET_YIELDS);
+    }
+
+    // Nothing buffered: hand the receive buffer back until more data arrives.
+    if (connection.write_offset == 0) {
+        buffer_pool.release(connection.buffer);
+    }
+}
+
+void handle_client_writable(int epoll_fd, int client_fd, Session& session) {
+    if (!flush_output(epoll_fd, client_fd, session)) {
+        close_client_connection(epoll_fd, client_fd);
+        return;
+    }
+
+    // Input that arrived while paused raised no new edge, so drain it now.
+    if (session.reading_paused && session.connection->output_bytes <= OUTPUT_LOW_WATER_MARK) {
+        session.reading_paused = false;
+        handle_client_data(epoll_fd, client_fd, session);
+    }
+}
+
+// Resumes each connection whose login has come back: the frames queued up
+// behind the login are parsed, then the socket is drained, since input that
+// arrived while parked raised no new edge.
+void handle_login_results(int epoll_fd) {
+    login_inbox.drain(login_results);
+    for (const LoginJob& login : login_results) {
+        Session* session = find_session(login.tag);
+        if (session == nullptr || session->connection->closing) {
+            continue;
+        }
+        int client_fd = static_cast<int>(static_cast<uint32_t>(login.tag));
+        if (!finish_login(*session, login) || !process_frames(*session) || !flush_output(epoll_fd, client_fd, *session)) {
+            close_client_connection(epoll_fd, client_fd);
+            continue;
+        }
+        if (!reading_parked(*session)) {
+            handle_client_data(epoll_fd, client_fd, *session);
+        }
+    }
+}
+
+// Gives every connection on the ready list another read budget, in the
+// order they ran out. Those that use it up again go back on the list for
+// the next pass, behind the connections whose events arrive meanwhile.
+// A connection that was parked since it was queued is left to whatever
+// unparks it. Returns whether there was anything to serve.
+bool serve_ready_sessions(int epoll_fd) {
+    if (ready_sessions.empty()) {
+        return false;
+    }
+    ready_serving.swap(ready_sessions);
+    for (uint64_t tag : ready_serving) {
+        Session* session = find_session(tag);
+        if (session == nullptr || session->connection->closing) {
+            continue;
+        }
+        session->connection->ready_queued = false;
+        if (!reading_parked(*session)) {
+            handle_client_data(epoll_fd, session_fd(*session), *session);
+        }
+    }
+    ready_serving.clear();
+    return true;
+}
+
+// A connection with zero-copy sends outstanding stays registered, and its
+// fd open, until their notifications arrive: the kernel may still be
+// reading its pinned buffers, and only the socket can say when it is done.
+void close_client_connection(int epoll_fd, int client_fd) {
+    Session& session = sessions[client_fd];
+    Connection* connection = session.open ? session.connection : nullptr;
+    if (connection != nullptr && connection->zerocopy_head < connection->zerocopy_pinned.size()) {
+        reap_zerocopy_completions(client_fd, *connection);
+        if (connection->zerocopy_head < connection->zerocopy_pinned.size()) {
+            if (!connection->closing) {
+                connection->closing = true;
+                shutdown(client_fd, SHUT_RD);
+                uint64_t tag = session_tag(client_fd, session.generation);
+                if (connection->timer_scheduled) {
+                    timer_wheel.cancel(connection->timer_deadline, tag);
+                }
+                connection->timer_deadline = timer_wheel.schedule(timer_wheel.now() + ZEROCOPY_CLOSE_GRACE_TICKS, tag);
+                connection->timer_scheduled = true;
+                return;
+            }
+            LOG_INFO("Zero-copy sends still pending after the close grace period, resetting fd: %d", client_fd);
+            struct linger reset = {1, 0};
+            setsockopt(client_fd, SOL_SOCKET, SO_LINGER, &reset, sizeof reset);
+        }
+    }
+
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client_fd, NULL) == -1) {
+        LOG_ERROR("Error removing client fd from epoll: %s", strerror(errno));
+    }
+
+    release_session(client_fd);
+}
+
+void release_session(int client_fd) {
+    if (static_cast<size_t>(client_fd) < sessions.size() && sessions[client_fd].open) {
+        Session& session = sessions[client_fd];
+        if (session.logged_in) {
+            LOG_DEBUG("Logged user removed, fd: %d", client_fd);
+        }
+        if (session.connection->capture_id != 0) {
+            capture_close(session.connection->capture_id);
+        }
+        if (session.connection->timer_scheduled) {
+            timer_wheel.cancel(session.connection->timer_deadline, session_tag(client_fd, session.generation));
+        }
+        buffer_pool.release(session.connection->buffer);
+        buffer_pool.release(session.connection->output);
+        buffer_pool.release(session.connection->inflight);
+        for (ZeroCopyPin& pin : session.connection->zerocopy_pinned) {
+            buffer_pool.release(pin.buffer);
+        }
+        slab_delete(session.connection);
+        session.connection = nullptr;
+        session.open = false;
+        session.logged_in = false;
+        active_connections.fetch_sub(1, std::memory_order_relaxed);
+        stats_count(StatsCounter::CLOSED);
+    }
+
+    close(client_fd);
+    LOG_DEBUG("Connection closed, fd: %d", client_fd);
+}
+
+// io_uring reactor: multishot accept and multishot receive into a ring of
+// provided buffers, with every send queued during a pass submitted by the
+// single io_uring_enter that also waits for the next completions. Frames go
+// through the same parser and handlers as the epoll backend.
+int run_uring_reactor(int server_fd) {
+    IoUring ring;
+    int error = ring.init(URING_ENTRIES);
+    if (error == 0) {
+        error = ring.provide_buffers(URING_BUFFER_GROUP, URING_BUFFER_COUNT, URING_BUFFER_SIZE);
+    }
+    if (error < 0) {
+        LOG_WARN("Error setting up io_uring: %s", strerror(-error));
+        return BACKEND_UNAVAILABLE;
+    }
+
+    int timer_fd = -1;
+    if (timeouts_enabled()) {
+        timer_fd = open_tick_timer();
+        if (timer_fd == -1) {
+            LOG_ERROR("Error setting up the connection timer: %s", strerror(errno));
+            close(server_fd);
+            return 1;
+        }
+        uring_arm_timer(ring, UringOp::TIMER, timer_fd, timer_expirations);
+    }
+
+    if (rate_limits_enabled()) {
+        throttle_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (throttle_fd == -1) {
+            LOG_ERROR("Error setting up the throttle timer: %s", strerror(errno));
+            if (timer_fd != -1) {
+                close(timer_fd);
+            }
+            close(server_fd);
+            return 1;
+        }
+        uring_arm_timer(ring, UringOp::THROTTLE, throttle_fd, throttle_expirations);
+    }
+
+    if (!login_inbox.open()) {
+        LOG_ERROR("Error setting up the login inbox: %s", strerror(errno));
+        if (throttle_fd != -1) {
+            close(throttle_fd);
+        }
+        if (timer_fd != -1) {
+            close(timer_fd);
+        }
+        close(server_fd);
+        return 1;
+    }
+    uring_arm_login_inbox(ring);
+
+    uring_arm_accept(ring, server_fd);
+    bool accepted = false;
+    while (true) {
+        publish_reactor_stats();
+        bool spinning = false;
+        uint64_t wait_start = 0;
+        if (config.low_latency) {
+            wait_start = stats_clock();
+            spinning = spin_timeout(wait_start) == 0;
+        }
+        int result = spinning ? ring.submit_and_poll() : ring.submit_and_wait(1);
+        if (result < 0 && result != -EINTR) {
+            LOG_ERROR("Error during io_uring_enter: %s", strerror(-result));
+            break;
+        }
+        uint64_t work_start = 0;
+        if (config.low_latency) {
+            work_start = stats_clock();
+            account_wait(wait_start, work_start, !spinning);
+        }
+
+        bool handled = false;
+        io_uring_cqe* entry;
+        while ((entry = ring.peek_cqe()) != nullptr) {
+            handled = true;
+            io_uring_cqe cqe = *entry;
+            ring.cqe_seen();
+
+            UringOp op = static_cast<UringOp>(cqe.user_data >> 56);
+            int fd = static_cast<int>(static_cast<uint32_t>(cqe.user_data));
+            if (op == UringOp::ACCEPT) {
+                if (cqe.res >= 0) {
+                    accepted = true;
+                    if (admit_connection(cqe.res)) {
+                        if (config.low_latency) {
+                            tune_low_latency_socket(cqe.res);
+                        }
+                        uring_arm_receive(ring, cqe.res, *open_session(cqe.res).connection);
+                    }
+                } else if (cqe.res == -EINVAL && !accepted) {
+                    // Multishot accept needs Linux 5.19.
+                    if (throttle_fd != -1) {
+                        close(throttle_fd);
+                        throttle_fd = -1;
+                    }
+                    if (timer_fd != -1) {
+                        close(timer_fd);
+                    }
+                    return BACKEND_UNAVAILABLE;
+                } else if (cqe.res == -EMFILE || cqe.res == -ENFILE) {
+                    // Re-arming the accept would fail again straight away,
+                    // so once the queue is drained wait for the listener to
+                    // become readable instead.
+                    while (shed_connection(server_fd)) {
+                    }
+                    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                        uring_arm_listen_poll(ring, server_fd);
+                    }
+                    continue;
+                } else {
+                    LOG_ERROR("Error accepting new connection: %s", strerror(-cqe.res));
+                }
+                if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                    uring_arm_accept(ring, server_fd);
+                }
+            } else if (op == UringOp::LISTEN_POLL) {
+                uring_arm_accept(ring, server_fd);
+            } else if (op == UringOp::TIMER) {
+                if (cqe.res == sizeof timer_expirations) {
+                    expire_sessions(timer_expirations, timer_expired);
+                    for (int expired_fd : timer_expired) {
+                        uring_close_connection(ring, expired_fd);
+                    }
+                }
+                uring_arm_timer(ring, UringOp::TIMER, timer_fd, timer_expirations);
+            } else if (op == UringOp::THROTTLE) {
+                if (cqe.res == sizeof throttle_expirations) {
+                    expire_throttles(throttle_resumed);
+                    for (int resumed_fd : throttle_resumed) {
+                        Session& session = sessions[resumed_fd];
+                        if (!session.connection->receive_armed && !reading_parked(session)) {
+                            uring_arm_receive(ring, resumed_fd, *session.connection);
+                        }
+                    }
+                }
+                uring_arm_timer(ring, UringOp::THROTTLE, throttle_fd, throttle_expirations);
+            } else if (op == UringOp::LOGIN) {
+                uring_handle_login_results(ring);
+                uring_arm_login_inbox(ring);
+            } else if (op == UringOp::RECEIVE) {
+                uring_handle_receive(ring, fd, cqe);
+            } else if (op == UringOp::SEND) {
+                uring_handle_send(ring, fd, cqe);
+            }
+        }
+        if (config.low_latency && handled) {
+            account_work(work_start, stats_clock());
+        }
+    }
+
+    if (throttle_fd != -1) {
+        close(throttle_fd);
+    }
+    if (timer_fd != -1) {
+        close(timer_fd);
+    }
+    close(server_fd);
+    return 0;
+}
+
+uint64_t uring_tag(UringOp op, int fd) {
+    return (static_cast<uint64_t>(op) << 56) | static_cast<uint32_t>(fd);
+}
+
+void uring_arm_accept(IoUring& ring, int server_fd) {
+    io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = server_fd;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = uring_tag(UringOp::ACCEPT, server_fd);
+}
+
+void uring_arm_listen_poll(IoUring& ring, int server_fd) {
+    io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = server_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = uring_tag(UringOp::LISTEN_POLL, server_fd);
+}
+
+// The timerfd is read, rather than polled, so one completion per tick
+// carries the expiration count.
+void uring_arm_timer(IoUring& ring, UringOp op, int timer_fd, uint64_t& expirations) {
+    io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = timer_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(&expirations);
+    sqe->len = sizeof expirations;
+    sqe->off = static_cast<uint64_t>(-1);
+    sqe->user_data = uring_tag(op, timer_fd);
+}
+
+// Polled rather than read: draining the inbox resets the eventfd itself.
+void uring_arm_login_inbox(IoUring& ring) {
+    io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = login_inbox.fd();
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = uring_tag(UringOp::LOGIN, login_inbox.fd());
+}
+
+void uring_arm_receive(IoUring& ring, int client_fd, Connection& connection) {
+    io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = client_fd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->ioprio = uring_multishot_receive ? IORING_RECV_MULTISHOT : 0;
+    sqe->user_data = uring_tag(UringOp::RECEIVE, client_fd);
+    connection.receive_armed = true;
+}
+
+// At most one send per connection is in flight. It takes over the output
+// buffer, so responses produced meanwhile accumulate in a new one.
+void uring_submit_send(IoUring& ring, int client_fd, Connection& connection) {
+    if (connection.send_in_flight) {
+        return;
+    }
+    if (connection.inflight_bytes == 0) {
+        if (connection.output_bytes == 0) {
+            return;
+        }
+        buffer_pool.release(connection.inflight);
+        connection.inflight = connection.output;
+        connection.inflight_offset = connection.output_offset;
+        connection.inflight_bytes = connection.output_bytes;
+        connection.output = PooledBuffer();
+        connection.output_offset = 0;
+        connection.output_bytes = 0;
+    }
+
+    io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = client_fd;
+    sqe->addr = reinterpret_cast<uint64_t>(connection.inflight.data + connection.inflight_offset);
+    sqe->len = connection.inflight_bytes;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = uring_tag(UringOp::SEND, client_fd);
+    connection.send_started = stats_clock();
+    connection.send_in_flight = true;
+}
+
+void uring_handle_receive(IoUring& ring, int client_fd, const io_uring_cqe& cqe) {
+    Session& session = sessions[client_fd];
+    Connection& connection = *session.connection;
+    if (!(cqe.flags & IORING_CQE_F_MORE)) {
+        connection.receive_armed = false;
+    }
+
+    if (cqe.res > 0) {
+        uint16_t buffer_id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        bool handled = connection.closing || uring_receive(ring, client_fd, session, ring.buffer(buffer_id), cqe.res);
+        ring.recycle_buffer(buffer_id);
+        if (!handled) {
+            uring_close_connection(ring, client_fd);
+            return;
+        }
+    } else if (cqe.res == -EINVAL && uring_multishot_receive) {
+        // Multishot receive needs Linux 6.0; re-arm as single-shot.
+        uring_multishot_receive = false;
+    } else if (cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+        if (cqe.res < 0) {
+            LOG_INFO("Error reading from client: %s", strerror(-cqe.res));
+        }
+        uring_close_connection(ring, client_fd);
+        return;
+    }
+
+    if (connection.closing) {
+        uring_finish_close(client_fd);
+    } else if (!connection.receive_armed && !reading_parked(session)) {
+        uring_arm_receive(ring, client_fd, connection);
+    }
+}
+
+// With no partial frame pending, the usual case, the frames are parsed
+// straight out of the provided buffer and only a partial frame left at its
+// end is copied into the connection's buffer. uring_process_input spills
+// the responses staged over those frames before the provided buffer goes
+// back to the kernel. Behind a partial frame the data is appended to it.
+bool uring_receive(IoUring& ring, int client_fd, Session& session, uint8_t* data, size_t size) {
+    Connection& connection = *session.connection;
+    if (connection.write_offset > connection.read_offset) {
+        reserve_receive_buffer(connection, size);
+        memcpy(connection.buffer.data + connection.write_offset, data, size);
+        connection.write_offset += size;
+        if (!uring_process_input(ring, client_fd, session)) {
+            return false;
+        }
+    } else {
+        PooledBuffer owned = connection.buffer;
+        connection.buffer = PooledBuffer{data, size};
+        connection.read_offset = 0;
+        connection.write_offset = size;
+        bool processed = uring_process_input(ring, client_fd, session);
+        size_t offset = connection.read_offset;
+        size_t pending = connection.write_offset - offset;
+        connection.buffer = owned;
+        connection.read_offset = 0;
+        connection.write_offset = 0;
+        if (!processed) {
+            return false;
+        }
+        if (pending > 0) {
+            reserve_receive_buffer(connection, pending);
+            memcpy(connection.buffer.data, data + offset, pending);
+            connection.write_offset = pending;
+        }
+    }
+    if (connection.write_offset == 0) {
+        buffer_pool.release(connection.buffer);
+    }
+    return true;
+}
+
+// Parses what has been received and sends the responses. The receive is
+// cancelled when that leaves the output backed up, a login out with the
+// workers or the connection over its rate limit; completions already on
+// their way are still buffered. There is no read budget: every receive
+// completion carries at most one provided buffer, and the kernel
+// interleaves those of all connections.
+bool uring_process_input(IoUring& ring, int client_fd, Session& session) {
+    Connection& connection = *session.connection;
+    bool parked = reading_parked(session);
+    if (!process_frames(session)) {
+        return false;
+    }
+    if (rate_limits_enabled() && !session.throttled) {
+        enforce_rate_limits(session, client_fd);
+    }
+    spill_staged(connection);
+    uring_submit_send(ring, client_fd, connection);
+    if (connection.output_bytes + connection.inflight_bytes >= OUTPUT_HIGH_WATER_MARK) {
+        session.reading_paused = true;
+    }
+    if (!parked && reading_parked(session) && connection.receive_armed) {
+        uring_pause_receive(ring, client_fd);
+    }
+    return true;
+}
+
+void uring_pause_receive(IoUring& ring, int client_fd) {
+    io_uring_sqe* sqe = ring.get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = uring_tag(UringOp::RECEIVE, client_fd);
+    sqe->user_data = uring_tag(UringOp::CANCEL, client_fd);
+}
+
+void uring_handle_login_results(IoUring& ring) {
+    login_inbox.drain(login_results);
+    for (const LoginJob& login : login_results) {
+        Session* session = find_session(login.tag);
+        if (session == nullptr || session->connection->closing) {
+            continue;
+        }
+        int client_fd = static_cast<int>(static_cast<uint32_t>(login.tag));
+        if (!finish_login(*session, login) || !uring_process_input(ring, client_fd, *session)) {
+            uring_close_connection(ring, client_fd);
+            continue;
+        }
+        if (session->connection->write_offset == 0) {
+            buffer_pool.release(session->connection->buffer);
+        }
+        if (!session->connection->receive_armed && !reading_parked(*session)) {
+            uring_arm_receive(ring, client_fd, *session->connection);
+        }
+    }
+}
+
+void uring_handle_send(IoUring& ring, int client_fd, const io_uring_cqe& cqe) {
+    Session& session = sessions[client_fd];
+    Connection& connection = *session.connection;
+    connection.send_in_flight = false;
+    thread_stats().send.record(stats_clock() - connection.send_started);
+
+    if (cqe.res < 0) {
+        LOG_INFO("Error sending data to client: %s", strerror(-cqe.res));
+        uring_close_connection(ring, client_fd);
+        return;
+    }
+
+    connection.inflight_offset += cqe.res;
+    connection.inflight_bytes -= cqe.res;
+    session.active_tick = timer_wheel.now();
+    session.bytes_sent += cqe.res;
+    stats_count(StatsCounter::BYTES_SENT, cqe.res);
+    if (connection.inflight_bytes == 0) {
+        buffer_pool.release(connection.inflight);
+        connection.inflight_offset = 0;
+    }
+
+    if (connection.closing) {
+        uring_finish_close(client_fd);
+        return;
+    }
+
+    uring_submit_send(ring, client_fd, connection);
+    if (session.reading_paused && connection.output_bytes + connection.inflight_bytes <= OUTPUT_LOW_WATER_MARK) {
+        session.reading_paused = false;
+        if (!connection.receive_armed && !reading_parked(session)) {
+            uring_arm_receive(ring, client_fd, connection);
+        }
+    }
+}
+
+// Shutting the socket down makes its pending receive and send complete; the
+// fd is closed and the session released once the last of them has.
+void uring_close_connection(IoUring& ring, int client_fd) {
+    Connection& connection = *sessions[client_fd].connection;
+    if (connection.closing) {
+        return;
+    }
+    connection.closing = true;
+    shutdown(client_fd, SHUT_RDWR);
+    if (connection.receive_armed) {
+        io_uring_sqe* sqe = ring.get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = uring_tag(UringOp::RECEIVE, client_fd);
+        sqe->user_data = uring_tag(UringOp::CANCEL, client_fd);
+    }
+    uring_finish_close(client_fd);
+}
+
+void uring_finish_close(int client_fd) {
+    Connection& connection = *sessions[client_fd].connection;
+    if (!connection.receive_armed && !connection.send_in_flight) {
+        release_session(client_fd);
+    }
 }
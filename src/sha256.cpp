@@ -0,0 +1,142 @@
+#include "sha256.hpp"
+#include <algorithm>
+#include <cstring>
+
+static const uint32_t SHA256_ROUND_CONSTANTS[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t rotate_right(uint32_t value, int bits) {
+    return (value >> bits) | (value << (32 - bits));
+}
+
+static void sha256_block(uint32_t* state, const uint8_t* block) {
+    uint32_t schedule[64];
+    for (int i = 0; i < 16; ++i) {
+        schedule[i] = uint32_t(block[i * 4]) << 24 | uint32_t(block[i * 4 + 1]) << 16 |
+                      uint32_t(block[i * 4 + 2]) << 8 | block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; ++i) {
+        uint32_t s0 = rotate_right(schedule[i - 15], 7) ^ rotate_right(schedule[i - 15], 18) ^ (schedule[i - 15] >> 3);
+        uint32_t s1 = rotate_right(schedule[i - 2], 17) ^ rotate_right(schedule[i - 2], 19) ^ (schedule[i - 2] >> 10);
+        schedule[i] = schedule[i - 16] + s0 + schedule[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+        uint32_t s1 = rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+        uint32_t choice = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + choice + SHA256_ROUND_CONSTANTS[i] + schedule[i];
+        uint32_t s0 = rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+        uint32_t majority = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + majority;
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+Sha256::Sha256() {
+    static const uint32_t initial[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                        0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(state, initial, sizeof state);
+}
+
+void Sha256::update(const uint8_t* data, size_t size) {
+    length += size;
+    if (block_bytes > 0) {
+        size_t taken = std::min(size, SHA256_BLOCK_SIZE - block_bytes);
+        memcpy(block + block_bytes, data, taken);
+        block_bytes += taken;
+        data += taken;
+        size -= taken;
+        if (block_bytes < SHA256_BLOCK_SIZE) {
+            return;
+        }
+        sha256_block(state, block);
+        block_bytes = 0;
+    }
+    for (; size >= SHA256_BLOCK_SIZE; data += SHA256_BLOCK_SIZE, size -= SHA256_BLOCK_SIZE) {
+        sha256_block(state, data);
+    }
+    memcpy(block, data, size);
+    block_bytes = size;
+}
+
+// Appends the 0x80 terminator and the bit length, in this block or the next.
+void Sha256::finish(uint8_t* digest) {
+    uint64_t bits = length * 8;
+    block[block_bytes++] = 0x80;
+    if (block_bytes > SHA256_BLOCK_SIZE - 8) {
+        memset(block + block_bytes, 0, SHA256_BLOCK_SIZE - block_bytes);
+        sha256_block(state, block);
+        block_bytes = 0;
+    }
+    memset(block + block_bytes, 0, SHA256_BLOCK_SIZE - 8 - block_bytes);
+    for (int i = 0; i < 8; ++i) {
+        block[SHA256_BLOCK_SIZE - 1 - i] = static_cast<uint8_t>(bits >> (i * 8));
+    }
+    sha256_block(state, block);
+
+    for (int i = 0; i < 8; ++i) {
+        digest[i * 4] = static_cast<uint8_t>(state[i] >> 24);
+        digest[i * 4 + 1] = static_cast<uint8_t>(state[i] >> 16);
+        digest[i * 4 + 2] = static_cast<uint8_t>(state[i] >> 8);
+        digest[i * 4 + 3] = static_cast<uint8_t>(state[i]);
+    }
+}
+
+void sha256(const uint8_t* data, size_t size, uint8_t* digest) {
+    Sha256 hash;
+    hash.update(data, size);
+    hash.finish(digest);
+}
+
+// RFC 2104. Keys longer than a block are hashed down first.
+void hmac_sha256(const uint8_t* key, size_t key_size, const uint8_t* data, size_t size, uint8_t* digest) {
+    uint8_t padded_key[SHA256_BLOCK_SIZE] = {};
+    if (key_size > SHA256_BLOCK_SIZE) {
+        sha256(key, key_size, padded_key);
+    } else {
+        memcpy(padded_key, key, key_size);
+    }
+
+    uint8_t pad[SHA256_BLOCK_SIZE];
+    for (size_t i = 0; i < SHA256_BLOCK_SIZE; ++i) {
+        pad[i] = padded_key[i] ^ 0x36;
+    }
+    uint8_t inner_digest[SHA256_DIGEST_SIZE];
+    Sha256 inner;
+    inner.update(pad, sizeof pad);
+    inner.update(data, size);
+    inner.finish(inner_digest);
+
+    for (size_t i = 0; i < SHA256_BLOCK_SIZE; ++i) {
+        pad[i] = padded_key[i] ^ 0x5c;
+    }
+    Sha256 outer;
+    outer.update(pad, sizeof pad);
+    outer.update(inner_digest, sizeof inner_digest);
+    outer.finish(digest);
+}
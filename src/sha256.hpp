@@ -0,0 +1,28 @@
+#ifndef SHA256_HPP
+#define SHA256_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+const size_t SHA256_DIGEST_SIZE = 32;
+const size_t SHA256_BLOCK_SIZE = 64;
+
+// Incremental SHA-256, for hashing a message that is not in one buffer.
+class Sha256 {
+public:
+    Sha256();
+
+    void update(const uint8_t* data, size_t size);
+    void finish(uint8_t* digest);
+
+private:
+    uint32_t state[8];
+    uint8_t block[SHA256_BLOCK_SIZE];
+    size_t block_bytes = 0;
+    uint64_t length = 0;
+};
+
+void sha256(const uint8_t* data, size_t size, uint8_t* digest);
+void hmac_sha256(const uint8_t* key, size_t key_size, const uint8_t* data, size_t size, uint8_t* digest);
+
+#endif
@@ -0,0 +1,221 @@
+#include "stats.hpp"
+#include "log.hpp"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const useconds_t STATS_RETRY_DELAY_US = 100000;
+
+static const char* const COUNTER_NAMES[STATS_COUNTER_COUNT] = {
+    "connections_accepted",
+    "connections_rejected",
+    "connections_shed",
+    "connections_timed_out",
+    "connections_closed",
+    "logins",
+    "login_failures",
+    "logins_rejected",
+    "resumptions",
+    "resumption_failures",
+    "echo_messages",
+    "echo_batches",
+    "stats_requests",
+    "protocol_errors",
+    "read_budget_yields",
+    "rate_limited",
+    "buffer_pool_hits",
+    "buffer_pool_misses",
+    "buffer_pool_bytes_held",
+    "keystream_cache_hits",
+    "keystream_cache_misses",
+    "bytes_received",
+    "bytes_sent",
+    "bytes_sent_zerocopy",
+    "bytes_zerocopy_copied",
+    "reactor_spin_ns",
+    "reactor_work_ns",
+    "reactor_sleep_ns",
+};
+
+// Threads register once and their stats are never freed, so the exporters
+// can read them without coordinating with reactor shutdown.
+static std::mutex registry_mutex;
+static std::vector<ThreadStats*> registry;
+
+ThreadStats& thread_stats() {
+    static thread_local ThreadStats* stats = [] {
+        ThreadStats* created = new ThreadStats();
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        registry.push_back(created);
+        return created;
+    }();
+    return *stats;
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds) {
+    size_t index = nanoseconds == 0 ? 0 : 63 - __builtin_clzll(nanoseconds);
+    if (index >= LATENCY_BUCKET_COUNT) {
+        index = LATENCY_BUCKET_COUNT - 1;
+    }
+    stats_add(buckets[index], 1);
+    stats_add(total_ns, nanoseconds);
+}
+
+uint64_t stats_clock() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+static void append_line(std::string& text, const char* name, uint64_t value) {
+    char line[128];
+    snprintf(line, sizeof line, "%s %llu\n", name, static_cast<unsigned long long>(value));
+    text += line;
+}
+
+// Emits the count, the sum, the p50/p99/p999 bucket bounds and the
+// cumulative non-empty buckets.
+static void append_histogram(std::string& text, const char* name, const uint64_t* buckets, uint64_t sum) {
+    uint64_t count = 0;
+    for (size_t i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+        count += buckets[i];
+    }
+
+    char key[128];
+    snprintf(key, sizeof key, "%s_count", name);
+    append_line(text, key, count);
+    snprintf(key, sizeof key, "%s_sum", name);
+    append_line(text, key, sum);
+
+    const struct {
+        const char* suffix;
+        double fraction;
+    } quantiles[] = {{"p50", 0.5}, {"p99", 0.99}, {"p999", 0.999}};
+    for (const auto& quantile : quantiles) {
+        uint64_t target = static_cast<uint64_t>(quantile.fraction * count);
+        uint64_t seen = 0;
+        uint64_t bound = 0;
+        for (size_t i = 0; i < LATENCY_BUCKET_COUNT && count > 0; ++i) {
+            seen += buckets[i];
+            if (seen > target) {
+                bound = (uint64_t(2) << i) - 1;
+                break;
+            }
+        }
+        snprintf(key, sizeof key, "%s_%s", name, quantile.suffix);
+        append_line(text, key, bound);
+    }
+
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+        if (buckets[i] == 0) {
+            continue;
+        }
+        cumulative += buckets[i];
+        snprintf(key, sizeof key, "%s_bucket{le=\"%llu\"}", name,
+                 static_cast<unsigned long long>((uint64_t(2) << i) - 1));
+        append_line(text, key, cumulative);
+    }
+}
+
+std::string format_stats(int active_connections) {
+    uint64_t counters[STATS_COUNTER_COUNT] = {};
+    uint64_t receive[LATENCY_BUCKET_COUNT] = {};
+    uint64_t decrypt[LATENCY_BUCKET_COUNT] = {};
+    uint64_t send[LATENCY_BUCKET_COUNT] = {};
+    uint64_t receive_sum = 0;
+    uint64_t decrypt_sum = 0;
+    uint64_t send_sum = 0;
+    size_t threads;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex);
+        threads = registry.size();
+        for (const ThreadStats* stats : registry) {
+            for (size_t i = 0; i < STATS_COUNTER_COUNT; ++i) {
+                counters[i] += stats->counters[i].load(std::memory_order_relaxed);
+            }
+            for (size_t i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+                receive[i] += stats->receive.bucket(i);
+                decrypt[i] += stats->decrypt.bucket(i);
+                send[i] += stats->send.bucket(i);
+            }
+            receive_sum += stats->receive.sum();
+            decrypt_sum += stats->decrypt.sum();
+            send_sum += stats->send.sum();
+        }
+    }
+
+    std::string text;
+    append_line(text, "reactor_threads", threads);
+    append_line(text, "active_connections", active_connections < 0 ? 0 : active_connections);
+    for (size_t i = 0; i < STATS_COUNTER_COUNT; ++i) {
+        append_line(text, COUNTER_NAMES[i], counters[i]);
+    }
+    append_histogram(text, "receive_ns", receive, receive_sum);
+    append_histogram(text, "decrypt_ns", decrypt, decrypt_sum);
+    append_histogram(text, "send_ns", send, send_sum);
+    return text;
+}
+
+int open_stats_socket(const char* path) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof address);
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof address.sun_path) {
+        LOG_ERROR("Stats socket path too long: %s", path);
+        return -1;
+    }
+    strcpy(address.sun_path, path);
+
+    int socket_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (socket_fd == -1) {
+        LOG_ERROR("Error creating stats socket: %s", strerror(errno));
+        return -1;
+    }
+    unlink(path);
+    if (bind(socket_fd, reinterpret_cast<struct sockaddr*>(&address), sizeof address) == -1 ||
+        listen(socket_fd, SOMAXCONN) == -1) {
+        LOG_ERROR("Error binding stats socket %s: %s", path, strerror(errno));
+        close(socket_fd);
+        return -1;
+    }
+    return socket_fd;
+}
+
+// Runs on its own thread, so a slow scraper never holds up a reactor.
+void serve_stats_socket(int socket_fd, const std::atomic<int>& active_connections) {
+    while (true) {
+        int client_fd = accept4(socket_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client_fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            if (errno == EMFILE || errno == ENFILE) {
+                usleep(STATS_RETRY_DELAY_US);
+                continue;
+            }
+            break;
+        }
+
+        std::string text = format_stats(active_connections.load(std::memory_order_relaxed));
+        size_t sent = 0;
+        while (sent < text.size()) {
+            ssize_t count = send(client_fd, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+            if (count == -1 && errno == EINTR) {
+                continue;
+            }
+            if (count <= 0) {
+                break;
+            }
+            sent += count;
+        }
+        close(client_fd);
+    }
+    close(socket_fd);
+}
@@ -0,0 +1,99 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Server-wide counters, kept per reactor thread and summed when read.
+enum class StatsCounter : size_t {
+    ACCEPTED,
+    REJECTED,
+    SHED,
+    TIMED_OUT,
+    CLOSED,
+    LOGINS,
+    LOGIN_FAILURES,
+    LOGINS_REJECTED,
+    RESUMPTIONS,
+    RESUMPTION_FAILURES,
+    ECHO_MESSAGES,
+    ECHO_BATCHES,
+    STATS_REQUESTS,
+    PROTOCOL_ERRORS,
+    READ_BUDGET_YIELDS,
+    RATE_LIMITED,
+    BUFFER_POOL_HITS,
+    BUFFER_POOL_MISSES,
+    BUFFER_POOL_BYTES_HELD,
+    KEYSTREAM_CACHE_HITS,
+    KEYSTREAM_CACHE_MISSES,
+    BYTES_RECEIVED,
+    BYTES_SENT,
+    BYTES_SENT_ZEROCOPY,
+    BYTES_ZEROCOPY_COPIED,
+    REACTOR_SPIN_NS,
+    REACTOR_WORK_NS,
+    REACTOR_SLEEP_NS,
+    COUNT
+};
+
+const size_t STATS_COUNTER_COUNT = static_cast<size_t>(StatsCounter::COUNT);
+
+// Bucket i counts durations in [2^i, 2^(i+1)) nanoseconds; the last bucket
+// also takes everything longer.
+const size_t LATENCY_BUCKET_COUNT = 40;
+
+// Counters and histograms are written only by the thread that owns them and
+// read concurrently by the exporters, so updates are a relaxed load and
+// store: no locked instruction on the data path, and readers never see a
+// torn value.
+inline void stats_add(std::atomic<uint64_t>& value, uint64_t amount) {
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+class LatencyHistogram {
+public:
+    void record(uint64_t nanoseconds);
+
+    uint64_t bucket(size_t index) const { return buckets[index].load(std::memory_order_relaxed); }
+    uint64_t sum() const { return total_ns.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> buckets[LATENCY_BUCKET_COUNT] = {};
+    std::atomic<uint64_t> total_ns{0};
+};
+
+struct alignas(64) ThreadStats {
+    std::atomic<uint64_t> counters[STATS_COUNTER_COUNT] = {};
+    LatencyHistogram receive;
+    LatencyHistogram decrypt;
+    LatencyHistogram send;
+};
+
+// The calling thread's stats, registered with the exporters on first use.
+ThreadStats& thread_stats();
+
+inline void stats_count(StatsCounter counter, uint64_t amount = 1) {
+    stats_add(thread_stats().counters[static_cast<size_t>(counter)], amount);
+}
+
+// For values a reactor's own structures already keep, such as its buffer
+// pool's and keystream cache's: copies the current value into the counter.
+inline void stats_set(StatsCounter counter, uint64_t value) {
+    thread_stats().counters[static_cast<size_t>(counter)].store(value, std::memory_order_relaxed);
+}
+
+// Monotonic nanoseconds for timing handler sections.
+uint64_t stats_clock();
+
+// Plain-text snapshot of every thread's stats, one "name value" per line.
+std::string format_stats(int active_connections);
+
+// Binds a Unix stream socket at path; serve_stats_socket then answers every
+// connection on it with a format_stats dump and closes it.
+int open_stats_socket(const char* path);
+void serve_stats_socket(int socket_fd, const std::atomic<int>& active_connections);
+
+#endif
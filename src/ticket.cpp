@@ -0,0 +1,88 @@
+#include "ticket.hpp"
+#include "sha256.hpp"
+#include <cerrno>
+#include <random>
+#include <sys/random.h>
+
+// A ticket is a random nonce, then the expiry and the key XORed with
+// HMAC(encryption_key, nonce), then the first bytes of
+// HMAC(mac_key, nonce || sealed).
+const size_t TICKET_NONCE_SIZE = 8;
+const size_t TICKET_SEALED_SIZE = sizeof(uint64_t) + 2;
+const size_t TICKET_TAG_SIZE = 16;
+const size_t TICKET_KEY_SIZE = 32;
+
+static_assert(TICKET_NONCE_SIZE + TICKET_SEALED_SIZE + TICKET_TAG_SIZE == RESUME_TICKET_BYTE_SIZE,
+              "ticket layout must fill RESUME_TICKET_BYTE_SIZE");
+
+// Written once before the reactors start and only read after that.
+static uint8_t encryption_key[TICKET_KEY_SIZE];
+static uint8_t mac_key[TICKET_KEY_SIZE];
+
+static bool fill_random(uint8_t* data, size_t size) {
+    size_t filled = 0;
+    while (filled < size) {
+        ssize_t count = getrandom(data + filled, size - filled, 0);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count == -1) {
+            return false;
+        }
+        filled += count;
+    }
+    return true;
+}
+
+bool init_ticket_keys() {
+    return fill_random(encryption_key, sizeof encryption_key) && fill_random(mac_key, sizeof mac_key);
+}
+
+static void apply_ticket_pad(const uint8_t* nonce, const uint8_t* input, uint8_t* output) {
+    uint8_t pad[SHA256_DIGEST_SIZE];
+    hmac_sha256(encryption_key, sizeof encryption_key, nonce, TICKET_NONCE_SIZE, pad);
+    for (size_t i = 0; i < TICKET_SEALED_SIZE; ++i) {
+        output[i] = input[i] ^ pad[i];
+    }
+}
+
+void seal_ticket(const EchoKey& key, uint64_t expires, uint8_t* ticket) {
+    // Nonces only need to be unique, not secret.
+    static thread_local std::mt19937_64 nonces(std::random_device{}());
+    uint64_t nonce = nonces();
+    memcpy(ticket, &nonce, TICKET_NONCE_SIZE);
+
+    uint8_t plain[TICKET_SEALED_SIZE];
+    memcpy(plain, &expires, sizeof expires);
+    plain[sizeof expires] = key.username_sum;
+    plain[sizeof expires + 1] = key.password_sum;
+    apply_ticket_pad(ticket, plain, ticket + TICKET_NONCE_SIZE);
+
+    uint8_t tag[SHA256_DIGEST_SIZE];
+    hmac_sha256(mac_key, sizeof mac_key, ticket, TICKET_NONCE_SIZE + TICKET_SEALED_SIZE, tag);
+    memcpy(ticket + TICKET_NONCE_SIZE + TICKET_SEALED_SIZE, tag, TICKET_TAG_SIZE);
+}
+
+bool open_ticket(const uint8_t* ticket, uint64_t now, EchoKey& key) {
+    uint8_t tag[SHA256_DIGEST_SIZE];
+    hmac_sha256(mac_key, sizeof mac_key, ticket, TICKET_NONCE_SIZE + TICKET_SEALED_SIZE, tag);
+    const uint8_t* received = ticket + TICKET_NONCE_SIZE + TICKET_SEALED_SIZE;
+    uint8_t difference = 0;
+    for (size_t i = 0; i < TICKET_TAG_SIZE; ++i) {
+        difference |= tag[i] ^ received[i];
+    }
+    if (difference != 0) {
+        return false;
+    }
+
+    uint8_t plain[TICKET_SEALED_SIZE];
+    apply_ticket_pad(ticket, ticket + TICKET_NONCE_SIZE, plain);
+    uint64_t expires;
+    memcpy(&expires, plain, sizeof expires);
+    if (now >= expires) {
+        return false;
+    }
+    key.username_sum = plain[sizeof expires];
+    key.password_sum = plain[sizeof expires + 1];
+    return true;
+}
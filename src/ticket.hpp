@@ -0,0 +1,24 @@
+#ifndef TICKET_HPP
+#define TICKET_HPP
+
+#include "common.hpp"
+
+// Resumption tickets carry a session's echo key and an expiry time, sealed
+// with keys that only this server process holds: encrypted with an
+// HMAC-SHA256 keystream and authenticated with a truncated HMAC-SHA256 tag.
+// The server keeps no record of the tickets it hands out, so any reactor
+// can open any ticket. Tickets do not survive a restart.
+//
+// Picks the sealing keys. Returns false, with errno set, if no randomness
+// was available.
+bool init_ticket_keys();
+
+// Writes a RESUME_TICKET_BYTE_SIZE ticket for key, valid until expires
+// (seconds since the epoch).
+void seal_ticket(const EchoKey& key, uint64_t expires, uint8_t* ticket);
+
+// Returns false for a ticket that was forged, tampered with or has
+// expired by now.
+bool open_ticket(const uint8_t* ticket, uint64_t now, EchoKey& key);
+
+#endif
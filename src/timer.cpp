@@ -0,0 +1,53 @@
+#include "timer.hpp"
+
+static_assert((TIMER_WHEEL_SLOTS & (TIMER_WHEEL_SLOTS - 1)) == 0, "TIMER_WHEEL_SLOTS must be a power of two");
+
+// Tick arithmetic wraps, so compare by signed distance.
+static bool is_due(uint32_t deadline, uint32_t tick) {
+    return static_cast<int32_t>(deadline - tick) <= 0;
+}
+
+TimerWheel::TimerWheel() : slots(TIMER_WHEEL_SLOTS) {}
+
+uint32_t TimerWheel::schedule(uint32_t deadline, uint64_t tag) {
+    if (is_due(deadline, current_tick)) {
+        deadline = current_tick + 1;
+    }
+    slots[deadline & (TIMER_WHEEL_SLOTS - 1)].push_back({deadline, tag});
+    ++entry_count;
+    return deadline;
+}
+
+// Order within a slot does not matter, so the last entry fills the gap.
+void TimerWheel::cancel(uint32_t deadline, uint64_t tag) {
+    std::vector<Entry>& slot = slots[deadline & (TIMER_WHEEL_SLOTS - 1)];
+    for (Entry& entry : slot) {
+        if (entry.tag == tag && entry.deadline == deadline) {
+            entry = slot.back();
+            slot.pop_back();
+            --entry_count;
+            return;
+        }
+    }
+}
+
+// After a stall longer than a rotation every slot is visited once, against
+// the final tick.
+void TimerWheel::advance(uint64_t ticks, std::vector<uint64_t>& due) {
+    uint32_t target = current_tick + static_cast<uint32_t>(ticks);
+    uint64_t steps = ticks < TIMER_WHEEL_SLOTS ? ticks : TIMER_WHEEL_SLOTS;
+    for (uint64_t step = 1; step <= steps; ++step) {
+        std::vector<Entry>& slot = slots[(current_tick + step) & (TIMER_WHEEL_SLOTS - 1)];
+        size_t kept = 0;
+        for (const Entry& entry : slot) {
+            if (is_due(entry.deadline, target)) {
+                due.push_back(entry.tag);
+            } else {
+                slot[kept++] = entry;
+            }
+        }
+        entry_count -= slot.size() - kept;
+        slot.resize(kept);
+    }
+    current_tick = target;
+}
@@ -0,0 +1,50 @@
+#ifndef TIMER_HPP
+#define TIMER_HPP
+
+#include <cstddef>
+#include <climits>
+#include <cstdint>
+#include <vector>
+
+// Hashed timing wheel over an abstract tick counter. An entry due at tick t
+// lives in slot t % TIMER_WHEEL_SLOTS, so scheduling is O(1) and each tick
+// only looks at one slot; entries more than a rotation away stay in their
+// slot until their own turn comes round. Cancelling an entry scans its
+// slot, so owners that go away should cancel rather than leave the entry
+// to fire. Not thread-safe: each reactor thread owns its own wheel.
+const size_t TIMER_WHEEL_SLOTS = 512;
+
+// Ticks are compared by signed distance, so no deadline can be further
+// ahead than this.
+const uint32_t TIMER_MAX_DELAY = INT32_MAX;
+
+class TimerWheel {
+public:
+    TimerWheel();
+
+    uint32_t now() const { return current_tick; }
+    size_t size() const { return entry_count; }
+
+    // Deadlines that are already due fire on the next tick. Returns the
+    // deadline the entry was filed under, which cancel takes.
+    uint32_t schedule(uint32_t deadline, uint64_t tag);
+
+    // Removes the entry filed under deadline for tag, if it has not fired.
+    void cancel(uint32_t deadline, uint64_t tag);
+
+    // Moves the wheel forward by ticks and appends the tag of every entry
+    // that came due to due, removing it from the wheel.
+    void advance(uint64_t ticks, std::vector<uint64_t>& due);
+
+private:
+    struct Entry {
+        uint32_t deadline;
+        uint64_t tag;
+    };
+
+    std::vector<std::vector<Entry>> slots;
+    uint32_t current_tick = 0;
+    size_t entry_count = 0;
+};
+
+#endif
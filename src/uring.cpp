@@ -0,0 +1,232 @@
+#include "uring.hpp"
+#include <cerrno>
+#include <cstring>
+#include <new>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static int io_uring_setup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int io_uring_register(int fd, unsigned opcode, void* arg, unsigned count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+IoUring::~IoUring() {
+    delete[] buffers;
+    if (buffer_ring != nullptr) {
+        munmap(buffer_ring, buffer_ring_size);
+    }
+    if (sqes != nullptr) {
+        munmap(sqes, sqes_size);
+    }
+    if (cq_ring != nullptr && cq_ring != sq_ring) {
+        munmap(cq_ring, cq_ring_size);
+    }
+    if (sq_ring != nullptr) {
+        munmap(sq_ring, sq_ring_size);
+    }
+    if (ring_fd >= 0) {
+        close(ring_fd);
+    }
+}
+
+int IoUring::init(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof params);
+    params.flags = IORING_SETUP_SINGLE_ISSUER;
+    ring_fd = io_uring_setup(entries, &params);
+    if (ring_fd < 0 && errno == EINVAL) {
+        memset(&params, 0, sizeof params);
+        ring_fd = io_uring_setup(entries, &params);
+    }
+    if (ring_fd < 0) {
+        return -errno;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        return -EOPNOTSUPP;
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (cq_ring_size > sq_ring_size) {
+        sq_ring_size = cq_ring_size;
+    }
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    if (sq_ring == MAP_FAILED) {
+        sq_ring = nullptr;
+        return -errno;
+    }
+    cq_ring = sq_ring;
+
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqe_memory = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sqe_memory == MAP_FAILED) {
+        return -errno;
+    }
+    sqes = static_cast<io_uring_sqe*>(sqe_memory);
+
+    uint8_t* sq = static_cast<uint8_t*>(sq_ring);
+    sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_entries = params.sq_entries;
+
+    uint8_t* cq = static_cast<uint8_t*>(cq_ring);
+    cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return 0;
+}
+
+// Hands count buffers of size bytes to the kernel as buffer group group.
+// Receives with IOSQE_BUFFER_SELECT pick one and report its id in the
+// completion; it stays with the application until it is recycled. count
+// must be a power of two, as a buffer ring requires.
+int IoUring::provide_buffers(uint16_t group, unsigned count, size_t size) {
+    buffers = new uint8_t[count * size];
+    buffer_size = size;
+    buffer_count = count;
+    buffer_group = group;
+    if (register_buffer_ring() == 0) {
+        return 0;
+    }
+
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = static_cast<int>(count);
+    sqe->addr = reinterpret_cast<uint64_t>(buffers);
+    sqe->len = static_cast<uint32_t>(size);
+    sqe->buf_group = group;
+    sqe->user_data = URING_INTERNAL_USER_DATA;
+    int result = submit_and_wait(1);
+    if (result < 0) {
+        return result;
+    }
+
+    io_uring_cqe* cqe = peek_cqe();
+    result = cqe->res;
+    cqe_seen();
+    return result < 0 ? result : 0;
+}
+
+// The ring is shared memory the kernel takes buffers from at its head; the
+// application adds them at the tail, which overlays the resv field of the
+// first entry. It is addressed as a plain array of io_uring_buf: under C++
+// the kernel header's io_uring_buf_ring puts its bufs member a few bytes
+// off, since the empty struct in its flexible array wrapper takes space.
+int IoUring::register_buffer_ring() {
+    buffer_ring_size = buffer_count * sizeof(io_uring_buf);
+    void* memory = mmap(nullptr, buffer_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return -errno;
+    }
+
+    io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof registration);
+    registration.ring_addr = reinterpret_cast<uint64_t>(memory);
+    registration.ring_entries = buffer_count;
+    registration.bgid = buffer_group;
+    if (io_uring_register(ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+        int error = -errno;
+        munmap(memory, buffer_ring_size);
+        return error;
+    }
+
+    buffer_ring = static_cast<io_uring_buf*>(memory);
+    for (unsigned id = 0; id < buffer_count; ++id) {
+        add_to_buffer_ring(static_cast<uint16_t>(id));
+    }
+    __atomic_store_n(&buffer_ring[0].resv, buffer_ring_tail, __ATOMIC_RELEASE);
+    return 0;
+}
+
+void IoUring::add_to_buffer_ring(uint16_t id) {
+    io_uring_buf* entry = &buffer_ring[buffer_ring_tail & (buffer_count - 1)];
+    entry->addr = reinterpret_cast<uint64_t>(buffer(id));
+    entry->len = static_cast<uint32_t>(buffer_size);
+    entry->bid = id;
+    ++buffer_ring_tail;
+}
+
+io_uring_sqe* IoUring::get_sqe() {
+    unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *sq_tail;
+    if (tail - head >= sq_entries) {
+        submit_and_wait(0);
+        head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+    }
+
+    unsigned index = tail & sq_mask;
+    io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof *sqe);
+    sq_array[index] = index;
+    __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++pending_submissions;
+    return sqe;
+}
+
+// Everything queued since the last call goes to the kernel in one
+// io_uring_enter, which also waits for completions when asked to.
+int IoUring::submit_and_wait(unsigned wait_count) {
+    unsigned flags = wait_count > 0 ? IORING_ENTER_GETEVENTS : 0;
+    if (pending_submissions == 0 && wait_count == 0) {
+        return 0;
+    }
+    int submitted = io_uring_enter(ring_fd, pending_submissions, wait_count, flags);
+    if (submitted < 0) {
+        return -errno;
+    }
+    pending_submissions -= static_cast<unsigned>(submitted) < pending_submissions ? submitted : pending_submissions;
+    return submitted;
+}
+
+int IoUring::submit_and_poll() {
+    int submitted = io_uring_enter(ring_fd, pending_submissions, 0, IORING_ENTER_GETEVENTS);
+    if (submitted < 0) {
+        return -errno;
+    }
+    pending_submissions -= static_cast<unsigned>(submitted) < pending_submissions ? submitted : pending_submissions;
+    return submitted;
+}
+
+io_uring_cqe* IoUring::peek_cqe() {
+    unsigned head = *cq_head;
+    if (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+        return nullptr;
+    }
+    return &cqes[head & cq_mask];
+}
+
+void IoUring::cqe_seen() {
+    __atomic_store_n(cq_head, *cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// With a buffer ring the kernel sees the buffer again as soon as the tail
+// moves. Otherwise the replacement rides along with the next submission;
+// it only posts a completion if the kernel rejects it.
+void IoUring::recycle_buffer(uint16_t id) {
+    if (buffer_ring != nullptr) {
+        add_to_buffer_ring(id);
+        __atomic_store_n(&buffer_ring[0].resv, buffer_ring_tail, __ATOMIC_RELEASE);
+        return;
+    }
+
+    io_uring_sqe* sqe = get_sqe();
+    sqe->opcode = IORING_OP_PROVIDE_BUFFERS;
+    sqe->fd = 1;
+    sqe->addr = reinterpret_cast<uint64_t>(buffer(id));
+    sqe->len = static_cast<uint32_t>(buffer_size);
+    sqe->buf_group = buffer_group;
+    sqe->off = id;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = URING_INTERNAL_USER_DATA;
+}
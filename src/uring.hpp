@@ -0,0 +1,77 @@
+#ifndef URING_HPP
+#define URING_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+
+// Completions the wrapper generates for its own bookkeeping carry this
+// user_data; callers should ignore them.
+const uint64_t URING_INTERNAL_USER_DATA = ~uint64_t(0);
+
+// Minimal io_uring wrapper over the raw syscalls: one submission/completion
+// ring pair plus an optional group of provided buffers for multishot
+// receives. The buffers are handed over through a registered buffer ring
+// where the kernel has one (Linux 5.19), so recycling one is a store to
+// the ring's tail; older kernels take them back with a PROVIDE_BUFFERS
+// submission each. Not thread-safe: each reactor thread owns its own ring.
+class IoUring {
+public:
+    IoUring() = default;
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+    ~IoUring();
+
+    // Returns 0 or a negative errno when the kernel lacks io_uring or a
+    // feature the server relies on.
+    int init(unsigned entries);
+    int provide_buffers(uint16_t group, unsigned count, size_t size);
+
+    // Never returns null: a full submission queue is flushed to the kernel.
+    io_uring_sqe* get_sqe();
+    int submit_and_wait(unsigned wait_count);
+    // Submits and runs the completion work the kernel has queued for this
+    // thread, without waiting, so that spinning on peek_cqe sees it.
+    int submit_and_poll();
+
+    io_uring_cqe* peek_cqe();
+    void cqe_seen();
+
+    uint8_t* buffer(uint16_t id) const { return buffers + static_cast<size_t>(id) * buffer_size; }
+    void recycle_buffer(uint16_t id);
+
+private:
+    int ring_fd = -1;
+    void* sq_ring = nullptr;
+    void* cq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    size_t cq_ring_size = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqes_size = 0;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    unsigned pending_submissions = 0;
+
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    int register_buffer_ring();
+    void add_to_buffer_ring(uint16_t id);
+
+    uint8_t* buffers = nullptr;
+    size_t buffer_size = 0;
+    unsigned buffer_count = 0;
+    uint16_t buffer_group = 0;
+
+    io_uring_buf* buffer_ring = nullptr;
+    size_t buffer_ring_size = 0;
+    uint16_t buffer_ring_tail = 0;
+};
+
+#endif